@@ -0,0 +1,28 @@
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "bench.h"
+
+double bench_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+long bench_peakrss(int self) {
+    struct rusage ru;
+
+    if (getrusage(self ? RUSAGE_SELF : RUSAGE_CHILDREN, &ru) != 0) return (-1);
+    return ru.ru_maxrss; /* kilobytes on Linux */
+}
+
+void bench_header(void) { printf("benchmark\tparams\tevents\tns_per_event\tevents_per_sec\tpeak_rss_kb\n"); }
+
+void bench_report(const char *name, const char *params, double events, double seconds, long rsskb) {
+    printf("%s\t%s\t%.0f\t%.2f\t%.0f\t%ld\n", name, params, events, seconds * 1e9 / events, events / seconds,
+           rsskb);
+    fflush(stdout);
+}
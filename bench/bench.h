@@ -0,0 +1,22 @@
+/* Shared helpers for the benchmarks in this directory.
+
+   Every benchmark prints one tab separated line per measurement with the
+   columns below, so the output of two commits can be compared with diff:
+
+   benchmark  params  events  ns_per_event  events_per_sec  peak_rss_kb
+
+   "events" is whatever the benchmark counts (calls, simulator events, ...),
+   peak_rss_kb is the peak resident set size of the measured process. */
+
+/* monotonic wall clock in seconds */
+extern double bench_now(void);
+
+/* peak resident set size of this process (self != 0) or of its waited-for
+   children (self == 0) in kilobytes */
+extern long bench_peakrss(int self);
+
+/* print the column header, once per run */
+extern void bench_header(void);
+
+/* print one result line */
+extern void bench_report(const char *name, const char *params, double events, double seconds, long rsskb);
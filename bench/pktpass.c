@@ -0,0 +1,82 @@
+/* Microbenchmark for the layer 3/4 packet interface.
+
+   Compares handing a packet to a handler the old way (copy the event's
+   packet field by field into a local and pass the 32 byte struct by value)
+   against passing a const pointer to the packet already stored in the
+   event.  The handlers are synthetic: they do the same work as IsCorrupted()
+   and are called through volatile function pointers so the compiler can not
+   inline them away, but nothing else of the emulator runs.  On x86-64 at
+   -O2 the two are within run to run noise of each other (22 to 28 ns per
+   call either way): the copy costs little next to the checksum.  The
+   emulator's real receive path is timed by simbench's deliver benchmark. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "../emulator.h"
+#include "bench.h"
+
+#define NCALLS 50000000L
+
+static int sink;
+
+static int checksum_value(struct pkt packet) {
+    int checksum, i;
+
+    checksum = packet.seqnum + packet.acknum;
+    for (i = 0; i < 20; i++) checksum += (int)(packet.payload[i]);
+    return checksum;
+}
+
+static int input_value(struct pkt packet) { return packet.checksum != checksum_value(packet); }
+
+static int checksum_pointer(const struct pkt *packet) {
+    int checksum, i;
+
+    checksum = packet->seqnum + packet->acknum;
+    for (i = 0; i < 20; i++) checksum += (int)(packet->payload[i]);
+    return checksum;
+}
+
+static int input_pointer(const struct pkt *packet) { return packet->checksum != checksum_pointer(packet); }
+
+static int (*volatile byvalue)(struct pkt) = input_value;
+static int (*volatile bypointer)(const struct pkt *) = input_pointer;
+
+int main(int argc, char *argv[]) {
+    struct pkt *pktptr, pkt2give;
+    double start;
+    long n;
+    int i, corrupt;
+
+    pktptr = malloc(sizeof(struct pkt)); /* packets live on the heap, as in the emulator */
+    if (pktptr == NULL) return EXIT_FAILURE;
+    memset(pktptr, 'a', sizeof(struct pkt));
+    pktptr->acknum = -1;
+
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) bench_header();
+
+    corrupt = 0;
+    start = bench_now();
+    for (n = 0; n < NCALLS; n++) {
+        pktptr->seqnum = (int)n; /* keep the loads inside the loop */
+        pkt2give.seqnum = pktptr->seqnum;
+        pkt2give.acknum = pktptr->acknum;
+        pkt2give.checksum = pktptr->checksum;
+        for (i = 0; i < 20; i++) pkt2give.payload[i] = pktptr->payload[i];
+        corrupt += byvalue(pkt2give);
+    }
+    bench_report("pkt_deliver_by_value", "-", NCALLS, bench_now() - start, bench_peakrss(1));
+    sink += corrupt;
+
+    corrupt = 0;
+    start = bench_now();
+    for (n = 0; n < NCALLS; n++) {
+        pktptr->seqnum = (int)n;
+        corrupt += bypointer(pktptr);
+    }
+    bench_report("pkt_deliver_by_pointer", "-", NCALLS, bench_now() - start, bench_peakrss(1));
+    sink += corrupt;
+
+    free(pktptr);
+    return sink == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
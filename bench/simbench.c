@@ -0,0 +1,233 @@
+/* Regression benchmarks for the emulator and one protocol.
+
+   The emulator is compiled into this file (with its main() renamed) so the
+   event list routines can be timed directly; build it once per protocol:
+
+       gcc -O2 -DDEFAULT_PROTOCOL='"gbn"' -o bench/simbench_gbn bench/simbench.c bench/bench.c \
+           protocols.c gbn.c sr.c sw.c
+
+   The suite is fixed so results are comparable between commits:
+   - evq:       insertevent() + pop of the head at steady list lengths
+   - tolayer3:  the send path (loss/corruption draws, copy, arrival scan)
+   - deliver:   the receive path: simulate() taking FROM_LAYER3 events off
+                the list and handing their packets to A_input(), with
+                duplicate ACKs, so the protocol does no more than check it
+   - checksum:  the shared ComputeChecksum()
+   - run:       complete simulations at several loss rates and message
+                counts, each in a forked child so peak RSS is per run
+   - flows:     complete simulations of 10 to 10000 flows sharing a
+                bottleneck with 0.04 packets per time unit per flow, so
+                ns/event shows how the per-event cost grows with flows
+   - parts:     the 1000 flow run spread over 0 (the ordinary run) to 8
+                processes (-P), so events/sec shows how a run scales with
+                cores; a run whose event count differs from the ordinary
+                run's is reported FAILED */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "bench.h"
+
+#define main emulator_main
+#define time emulator_time
+#include "../emulator.c"
+#undef main
+#undef time
+
+static int sink;
+static char *argv0[] = {"simbench", NULL};
+
+/* pop the head of the event list and release it */
+static void popevent(void) {
+    struct event *p = nextevent();
+
+    emulator_time = p->evtime;
+    if (p->evtype == FROM_LAYER3) free(p->pktptr);
+    free(p);
+}
+
+static void drainevents(void) {
+    while (nevlist > 0) popevent();
+}
+
+/* insert + pop with the list held at len events */
+static void bench_evq(int len, long n) {
+    struct event *p;
+    char params[32];
+    double start;
+    long i;
+
+    emulator_time = 0.0;
+    start = bench_now();
+    for (i = 0; i < len + n; i++) {
+        if (i == len) start = bench_now();
+        p = malloc(sizeof(struct event));
+        p->evtime = emulator_time + 20.0 * jimsrand();
+        p->evtype = TIMER_INTERRUPT;
+        p->eventity = A;
+        insertevent(p);
+        if (i >= len) popevent();
+    }
+    sprintf(params, "len=%d", len);
+    bench_report("evq_insert_pop", params, n, bench_now() - start, bench_peakrss(1));
+    drainevents();
+}
+
+static void bench_tolayer3(float loss, long n) {
+    struct pkt packet;
+    char params[32];
+    double start;
+    long i;
+
+    memset(&packet, 'a', sizeof(packet));
+    lossprob = loss;
+    corruptprob = loss;
+    corruptdirection = 2;
+    emulator_time = 0.0;
+    start = bench_now();
+    for (i = 0; i < n; i++) {
+        packet.seqnum = (int)i;
+        tolayer3(A, &packet);
+        if (nevlist > 0) popevent();
+    }
+    sprintf(params, "loss=%.1f", loss);
+    bench_report("tolayer3", params, n, bench_now() - start, bench_peakrss(1));
+}
+
+/* n ACKs for a packet before A's window go through simulate(), in batches */
+static void bench_deliver(long n) {
+    struct pkt ack;
+    struct event *p;
+    double start;
+    long i, j;
+
+    memset(&ack, '0', sizeof(ack));
+    ack.seqnum = 0;
+    ack.acknum = -1;
+    ack.checksum = ComputeChecksum(&ack);
+    selectflow(0);
+    proto->A_init();
+    proto->B_init();
+    emulator_time = 0.0;
+    start = bench_now();
+    for (i = 0; i < n; i += 1000) {
+        for (j = 0; j < 1000; j++) {
+            p = malloc(sizeof(struct event));
+            p->pktptr = malloc(sizeof(struct pkt));
+            *p->pktptr = ack;
+            p->evtime = emulator_time + 1.0 + j;
+            p->evtype = FROM_LAYER3;
+            p->eventity = A;
+            p->flow = 0;
+            inflight[A]++;
+            insertevent(p);
+        }
+        simulate(NULL, 1, FLT_MAX);
+    }
+    bench_report("deliver", DEFAULT_PROTOCOL, n, bench_now() - start, bench_peakrss(1));
+}
+
+static void bench_checksum(long n) {
+    int (*volatile checksum)(const struct pkt *) = ComputeChecksum;
+    struct pkt packet;
+    double start;
+    long i;
+
+    memset(&packet, 'a', sizeof(packet));
+    start = bench_now();
+    for (i = 0; i < n; i++) {
+        packet.seqnum = (int)i;
+        sink += checksum(&packet);
+    }
+    bench_report("checksum", DEFAULT_PROTOCOL, n, bench_now() - start, bench_peakrss(1));
+}
+
+/* run a complete simulation in a child, feeding init() its answers on stdin;
+   flows > 1 runs that many flows through a bottleneck, spread over parts
+   processes if parts > 0.  Returns the events simulated, 0 if it failed. */
+static long bench_run(int nmsgs, float loss, float corrupt, float interval, int flows, int parts) {
+    char input[128], params[96], nflows[16], rate[32], nparts[16];
+    char *argv[] = {"simbench", "-f", nflows, "-b", rate, "-P", nparts, NULL};
+    int in[2], out[2], status;
+    struct rusage ru;
+    long events;
+    double start;
+    pid_t pid;
+
+    if (loss != 0.0 || corrupt != 0.0) sprintf(input, "%d\n%f\n%f\n2\n%f\n0\n", nmsgs, loss, corrupt, interval);
+    else
+        sprintf(input, "%d\n%f\n%f\n%f\n0\n", nmsgs, loss, corrupt, interval);
+    sprintf(params, "%s:msgs=%d,loss=%.2f,corrupt=%.2f,lambda=%.0f", DEFAULT_PROTOCOL, nmsgs, loss, corrupt, interval);
+    if (flows > 1) sprintf(params + strlen(params), ",flows=%d", flows);
+    if (parts > 0) sprintf(params + strlen(params), ",parts=%d", parts);
+    sprintf(nflows, "%d", flows);
+    sprintf(rate, "%f", 0.04 * flows);
+    sprintf(nparts, "%d", parts);
+    if (pipe(in) != 0 || pipe(out) != 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    start = bench_now();
+    pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        close(in[1]);
+        close(out[0]);
+        if (freopen("/dev/null", "w", stdout) == NULL) _exit(EXIT_FAILURE);
+        status = flows > 1 ? emulator_main(parts > 0 ? 7 : 5, argv) : emulator_main(1, argv0);
+        if (write(out[1], &nevents, sizeof(nevents)) != sizeof(nevents)) _exit(EXIT_FAILURE);
+        _exit(status);
+    }
+    close(in[0]);
+    close(out[1]);
+    if (write(in[1], input, strlen(input)) < 0) perror("write");
+    close(in[1]);
+    if (read(out[0], &events, sizeof(events)) != sizeof(events)) events = 0;
+    close(out[0]);
+    if (wait4(pid, &status, 0, &ru) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || events == 0) {
+        printf("run\t%s\tFAILED\n", params);
+        return (0);
+    }
+    bench_report(parts > 0 ? "parts" : flows > 1 ? "flows" : "run", params, events, bench_now() - start,
+                 ru.ru_maxrss);
+    return (events);
+}
+
+int main(int argc, char *argv[]) {
+    static const float losses[] = {0.0, 0.05, 0.2};
+    static const int msgs[] = {1000, 2000, 5000};
+    static const int flows[] = {10, 100, 1000, 10000};
+    static const int parts[] = {1, 2, 4, 8};
+    unsigned int i, j;
+    long events = 0, n;
+
+    TRACE = 0;
+    rngseed(&rngmain, seed);
+    proto = findprotocol(DEFAULT_PROTOCOL);
+    allocflows(); /* tolayer3() acts on flow 0 */
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) bench_header();
+
+    bench_evq(4, 2000000);
+    bench_evq(64, 1000000);
+    bench_evq(1024, 200000);
+    bench_tolayer3(0.0, 2000000);
+    bench_tolayer3(0.2, 2000000);
+    bench_deliver(2000000);
+    bench_checksum(20000000);
+    for (i = 0; i < sizeof(msgs) / sizeof(msgs[0]); i++)
+        for (j = 0; j < sizeof(losses) / sizeof(losses[0]); j++) bench_run(msgs[i], losses[j], 0.05, 20.0, 1, 0);
+    for (i = 0; i < sizeof(flows) / sizeof(flows[0]); i++) {
+        n = bench_run(200000 / flows[i], 0.05, 0.05, 20.0, flows[i], 0);
+        if (flows[i] == 1000) events = n; /* the ordinary run the parts runs must match */
+    }
+    for (i = 0; i < sizeof(parts) / sizeof(parts[0]); i++)
+        if (bench_run(200, 0.05, 0.05, 20.0, 1000, parts[i]) != events) printf("parts\tparts=%d\tFAILED\n", parts[i]);
+
+    return sink == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+/* Library benchmark: short complete simulations through run_simulation()
+   (simulation.h), one after the other in this process, as a sweep or fuzz
+   harness runs them.  "events" is runs, so events_per_sec is runs per
+   second.  The first run of every configuration is repeated at the end,
+   and the benchmark fails unless the repeat gets the same results, so no
+   state leaks from one run into the next. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "../simulation.h"
+
+#define RUNS 20000 /* per configuration */
+
+static int failed;
+
+static void bench_lib(const char *protocol, int nmsgs, float loss) {
+    struct simconfig cfg;
+    struct simresults first, again;
+    char params[64];
+    double start;
+    long i;
+
+    simdefaults(&cfg);
+    cfg.protocol = protocol;
+    cfg.nmsgs = nmsgs;
+    cfg.loss = loss;
+    cfg.corrupt = loss;
+    cfg.lambda = 20.0;
+    sprintf(params, "%s:msgs=%d,loss=%.2f,corrupt=%.2f", protocol, nmsgs, loss, loss);
+
+    start = bench_now();
+    for (i = 0; i < RUNS; i++) {
+        cfg.seed = 1 + i;
+        if (run_simulation(&cfg, i == 0 ? &first : &again) != 0 || !(i == 0 ? first.ok : again.ok)) {
+            printf("lib_run\t%s\tFAILED\n", params);
+            failed = 1;
+            return;
+        }
+    }
+    bench_report("lib_run", params, RUNS, bench_now() - start, bench_peakrss(1));
+
+    cfg.seed = 1;
+    run_simulation(&cfg, &again);
+    if (again.time != first.time || again.events != first.events || again.delivered != first.delivered ||
+        again.resent != first.resent || again.lost != first.lost || again.cwnd != first.cwnd) {
+        printf("lib_run\t%s\tFAILED: the run is not repeatable\n", params);
+        failed = 1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static const char *const protos[] = {"gbn", "sr", "sw", "sr:aimd:nak"};
+    unsigned int i;
+
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) bench_header();
+    for (i = 0; i < sizeof(protos) / sizeof(protos[0]); i++) {
+        bench_lib(protos[i], 20, 0.0);
+        bench_lib(protos[i], 20, 0.2);
+        bench_lib(protos[i], 100, 0.2);
+    }
+    return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
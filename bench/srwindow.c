@@ -0,0 +1,127 @@
+/* Selective Repeat window benchmark: the cost of the SR engine's sender
+   per ACK and receiver per packet as the window grows.
+
+   The window is fixed when sr.c is compiled, so the Makefile builds this
+   once per size (bench/srwindow_6 ... bench/srwindow_65536, -DSR_WINDOWSIZE).
+   The emulator is compiled in (with its main() renamed, as in simbench.c)
+   and every packet the engine sends is lost, so what is timed is the engine
+   itself.  Each round fills the window and then acknowledges it:
+   - ack_inorder:  ACKs in sequence order, every one slides the window
+   - ack_reverse:  ACKs from the last packet back to the first, so all but
+                   the last arrive above a hole and only the last slides
+   - ack_stale:    ACKs for the previous window, every one outside the window
+   - rcv_reverse:  the receiver gets a window of packets last to first,
+                   buffering all but the last, which delivers them all */
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+
+#define main emulator_main
+#define time emulator_time
+#include "../emulator.c"
+#undef main
+#undef time
+
+#ifndef SR_WINDOWSIZE
+#define SR_WINDOWSIZE 6
+#endif
+#define WINDOWSIZE SR_WINDOWSIZE /* as sr.c sees them */
+#define SEQSPACE (2 * WINDOWSIZE)
+#define ROUNDS ((1L << 21) / WINDOWSIZE + 1) /* windows per benchmark */
+
+static char params[32];
+
+/* the n-th message handed to A, as the emulator would stamp it */
+static void message(long n, char data[20]) {
+    int i;
+
+    for (i = 0; i < IDPOS; i++) data[i] = 97 + n % 26;
+    stamp(data + IDPOS, n);
+    stamp(data + ORDPOS, n);
+}
+
+/* hand A a window of messages; returns the sequence number of the first */
+static int fillwindow(void) {
+    struct msg m;
+    int first = cur->nsim % SEQSPACE, i;
+
+    for (i = 0; i < WINDOWSIZE; i++) {
+        message(cur->nsim++, m.data);
+        proto->A_output(m);
+    }
+    return (first);
+}
+
+static void ack(int seq) {
+    struct pkt ackpkt;
+
+    memset(&ackpkt, '0', sizeof(ackpkt));
+    ackpkt.seqnum = 0;
+    ackpkt.acknum = seq % SEQSPACE;
+    ackpkt.checksum = ComputeChecksum(&ackpkt);
+    proto->A_input(&ackpkt);
+}
+
+/* order 0: in order, 1: reverse, 2: the window before */
+static void bench_ack(const char *name, int order) {
+    double elapsed = 0.0, start;
+    long r;
+    int first, i;
+
+    for (r = 0; r < ROUNDS; r++) {
+        first = fillwindow();
+        start = bench_now();
+        for (i = 0; i < WINDOWSIZE; i++)
+            if (order == 0) ack(first + i);
+            else if (order == 1)
+                ack(first + WINDOWSIZE - 1 - i);
+            else
+                ack(first + SEQSPACE - WINDOWSIZE + i);
+        elapsed += bench_now() - start;
+        for (i = 0; order == 2 && i < WINDOWSIZE; i++) ack(first + i); /* empty it, untimed */
+    }
+    bench_report(name, params, (double)ROUNDS * WINDOWSIZE, elapsed, bench_peakrss(1));
+}
+
+static void bench_receive(void) {
+    long r, base = 0;
+    struct pkt *pkts;
+    double start;
+    int i;
+
+    pkts = malloc(WINDOWSIZE * sizeof(struct pkt));
+    if (pkts == 0) exit(EXIT_FAILURE);
+    start = bench_now();
+    for (r = 0; r < ROUNDS; r++, base += WINDOWSIZE) {
+        for (i = 0; i < WINDOWSIZE; i++) {
+            pkts[i].seqnum = (base + i) % SEQSPACE;
+            pkts[i].acknum = -1;
+            message(base + i, pkts[i].payload);
+            pkts[i].checksum = ComputeChecksum(&pkts[i]);
+        }
+        for (i = WINDOWSIZE - 1; i >= 0; i--) proto->B_input(&pkts[i]);
+    }
+    bench_report("rcv_reverse", params, (double)ROUNDS * WINDOWSIZE, bench_now() - start, bench_peakrss(1));
+    free(pkts);
+}
+
+int main(int argc, char *argv[]) {
+    TRACE = 0;
+    rngseed(&rngmain, seed);
+    proto = findprotocol("sr");
+    allocflows();
+    lossprob = 1.0; /* every packet the engine sends is lost */
+    corruptdirection = 2;
+    proto->A_init();
+    proto->B_init();
+    if (argc > 1 && strcmp(argv[1], "-h") == 0) bench_header();
+    sprintf(params, "window=%d", WINDOWSIZE);
+
+    bench_ack("ack_inorder", 0);
+    bench_ack("ack_reverse", 1);
+    bench_ack("ack_stale", 2);
+    bench_receive();
+    return (cur->delivered == ROUNDS * WINDOWSIZE ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -34,21 +34,46 @@
    - fixed C style to adhere to current programming style
 
    ********************************************************************* */
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L /* fork() and friends for replications */
+#endif
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 #include "emulator.h"
-#include "gbn.h"
+#include "protocol.h"
+#include "simulation.h"
 
 struct event {
     float evtime;       /* event time */
     int evtype;         /* event type code */
     int eventity;       /* entity where event occurs */
     struct pkt *pktptr; /* ptr to packet (if any) assoc w/ this event */
-    struct event *prev;
-    struct event *next;
+    int flow;           /* flow the entity belongs to */
+    long seq;           /* insertion order */
+    int heappos;        /* index in evheap */
 };
 
-struct event *evlist = NULL; /* the event list */
+/* the event list is a binary min-heap ordered on time and, among events at
+   the same time, on the one inserted last first - the order the original
+   sorted linked list kept, so runs are unchanged - with O(log n) insertion
+   and removal however many flows keep events pending */
+static struct event **evheap;
+static int nevlist;     /* number of events in evheap */
+static int evheapsize;  /* allocated length of evheap */
+static long evseq;      /* insertions so far */
+
+/* the protocol engine being simulated, chosen with -p (see protocol.h) */
+#ifndef DEFAULT_PROTOCOL
+#define DEFAULT_PROTOCOL "gbn"
+#endif
+static const struct protocol *proto;
 
 /* possible events: */
 #define TIMER_INTERRUPT 0
@@ -62,6 +87,8 @@ int TRACE = 3;
 
 /* statistics updated by GBN */
 int window_full; /* count of the number of messages dropped due to full window */
+int cwnd_cuts;   /* count of the multiplicative decreases of the congestion window */
+int nak_resends; /* count of the packets resent because B sent a NAK for them */
 int total_ACKs_received;
 int packets_resent;   /* count of the number of packets resent  */
 int new_ACKs;         /* count of the number of acks correctly received */
@@ -73,6 +100,43 @@ static int packets_corrupt;
 static int packets_sent;
 static int packets_timeout;
 static int messages_delivered;
+static long nevents; /* number of events simulated */
+
+/* profiling (build with -DPROFILE, see the *_prof Makefile targets):
+   per event type counts and handler time, the longest the event list got,
+   and how many heap levels the event list routines move events over.  With
+   PROFILE undefined the macros below expand to nothing. */
+#define SCAN_INSERT 0
+#define SCAN_START 1
+#define SCAN_STOP 2
+#define SCAN_TOLAYER3 3
+#ifdef PROFILE
+extern long profclock(void); /* monotonic clock in nanoseconds, profile.c */
+static const char *const profevname[3] = {"timer interrupt", "from layer5", "from layer3"};
+static const char *const profscanname[4] = {"insert/next", "starttimer", "stoptimer", "tolayer3"};
+static long profcount[3];   /* events handled, by type */
+static long profns[3];      /* nanoseconds spent handling them, by type */
+static long proflistlen;    /* current length of the event list */
+static long profmaxlist;    /* longest the event list has been */
+static long profcalls[4];   /* calls to each event list routine */
+static long profsteps[4];   /* heap levels sifted by each */
+static long profstart;      /* start of the event being handled */
+#define PROF_CALL(which) (profcalls[which]++)
+#define PROF_STEP(which) (profsteps[which]++)
+#define PROF_LISTLEN(delta) \
+    ((proflistlen += (delta)) > profmaxlist ? (profmaxlist = proflistlen) : profmaxlist)
+#define PROF_EVENT_BEGIN() (profstart = profclock())
+#define PROF_EVENT_END(type) \
+    ((type) >= 0 && (type) < 3 ? (profcount[type]++, profns[type] += profclock() - profstart) : 0)
+#define PROF_REPORT() profreport()
+#else
+#define PROF_CALL(which) ((void)0)
+#define PROF_STEP(which) ((void)0)
+#define PROF_LISTLEN(delta) ((void)0)
+#define PROF_EVENT_BEGIN() ((void)0)
+#define PROF_EVENT_END(type) ((void)0)
+#define PROF_REPORT() ((void)0)
+#endif
 
 static int nsim = 0;    /* number of messages from 5 to 4 so far */
 static int nsimmax = 0; /* number of msgs to generate, then stop */
@@ -85,56 +149,339 @@ static int ntolayer3;        /* number sent into layer 3 */
 static int nlost;            /* number lost in media */
 static int ncorrupt;         /* number corrupted by media*/
 
+/* random number generator: the additive feedback generator behind glibc's
+   rand() (r[i] = r[i-3] + r[i-31]), so runs are unchanged, but with its
+   state held here where a checkpoint can save it. */
+#define RNGDEG 31
+#define RNGSEP 3
+#define RNGMAX 2147483647
+struct rng {
+    unsigned int state[RNGDEG];
+    int front, rear; /* indexes of r[i-3] and r[i-31] */
+};
+
+/* flows: nflows independent A->B connections, each with its own protocol
+   state (a proto->flowsize block in flowstate), timers, message stream and
+   statistics.  They share the channel and, if bnrate is set, a bottleneck.
+   The routines called by the protocols act on flow cur. */
+#define NAKWAIT 8 /* NAKs per flow timed to recovery at once, the oldest give way */
+struct flow {
+    struct event *timer[2]; /* pending timer interrupt of A and B, or NULL */
+    float lastarrival[2];   /* latest packet arrival scheduled at A and B */
+    int nsim;               /* messages handed to A */
+    int window_full;        /* of which A dropped due to a full window */
+    int delivered;          /* messages delivered to B's layer5 */
+    int resent;             /* packets resent by A */
+    long lastdelivered;     /* message id of the last message delivered to B */
+    float rto;              /* timeout A last started its timer with */
+    float cwnd;             /* A's congestion window, see setcwnd() */
+    float cwndsince;        /* time it was set */
+    double cwndarea;        /* integral of cwnd over time before cwndsince */
+    long linked;            /* A->B packets handed to the link process (partitioned runs) */
+    struct rng rng[3];      /* FLOWSTREAMS: the flow's A->B, B->A and arrival streams */
+    int naks;               /* NAKs sent by B, see naksent() */
+    int recovered;          /* NAKed packets that then arrived at B */
+    double recoverysum;     /* time from their NAK to their arrival, summed */
+    float recoverymax;      /* and the longest */
+    int npending;           /* NAKs whose packet has not arrived yet: */
+    int nakseq[NAKWAIT];    /* the packet asked for */
+    float naktime[NAKWAIT]; /* and when */
+};
+static struct flow *flows;
+static char *flowstate;
+static int nflows = 1;
+static struct flow *cur; /* the flow being served */
+
+/* the bottleneck: every flow's A->B packets go through one FIFO link that
+   sends bnrate packets per time unit and holds up to bnqueue packets, the
+   rest are dropped (drop tail).  bnrate == 0 means no bottleneck. */
+static float bnrate;
+static int bnqueue = 64;
+static float bnfree; /* time the link finishes sending the packets queued */
+static int bndrops;  /* packets dropped by the bottleneck */
+static int inflight[2]; /* packets in the channel on their way to A and B */
+static int nparts;      /* partitions of a partitioned run (-P), 0 for the ordinary run */
+static int nlinkq;      /* A->B packets waiting for the bottleneck, see PARTITIONS */
+
+/* the sampler: every sampleevery time units (0: never) a line with the
+   state just before the next event is appended to samplefp, a CSV file
+   written through a fixed size stdio buffer so memory stays bounded
+   however long the run */
+static float sampleevery;
+static long nsamples;          /* samples taken, the next is due at nsamples * sampleevery */
+static FILE *samplefp;
+static const char *samplerun;  /* first column: the run, as named on -p */
+static char ckptrun[32];       /* samplerun of a resumed run, from its checkpoint */
+static char samplebuf[1 << 16];
+
+/* delivery verification: every message handed to layer 4 carries its global
+   message id and its ordinal among the messages accepted by the sender (i.e.
+   not dropped due to a full window).  B must deliver ordinals 0, 1, 2, ...
+   so a single counter is enough to check order, gaps and duplicates. */
+#define STAMPLEN 5                 /* base-64 digits per stamp */
+#define STAMPMOD (1L << (6 * STAMPLEN)) /* stamps wrap at 2^30 */
+#define IDPOS (20 - 2 * STAMPLEN)  /* payload[0..IDPOS-1] holds the letter fill */
+#define ORDPOS (20 - STAMPLEN)
+static const char stampdigits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz+/";
+static int embedded;  /* running for run_simulation(), see LIBRARY */
+static int runfailed; /* a delivery check failed, stop the run */
+
+/* The original emulator draws every random number from one stream
+   (rngmain).  When several protocols are compared, arrivals keep rngmain
+   and each direction of the channel draws from its own stream, a fixed
+   four numbers per packet, so every protocol sees the same arrivals and
+   the n-th packet sent in each direction meets the same loss, delay and
+   corruption (common random numbers).  With several flows every flow has
+   its own three streams (struct flow), so what a flow draws does not
+   depend on the order events of different flows are handled in, and a
+   partitioned run draws what the ordinary run does. */
+static struct rng rngmain, rngchannel[2];
+static int splitstreams;        /* channel uses rngchannel[] */
+#define FLOWSTREAMS (nflows > 1) /* every flow draws from its own streams */
+static unsigned int seed = 9999; /* seed of the run */
+
+static int rngnext(struct rng *r) {
+    unsigned int val;
+
+    val = r->state[r->front] += r->state[r->rear];
+    r->front = (r->front + 1) % RNGDEG;
+    r->rear = (r->rear + 1) % RNGDEG;
+    return (int)(val >> 1);
+}
+
+static void rngseed(struct rng *r, unsigned int seed) {
+    long word, hi, lo;
+    int i;
+
+    word = seed == 0 ? 1 : seed;
+    r->state[0] = word;
+    for (i = 1; i < RNGDEG; i++) { /* 16807 * word % RNGMAX without overflow */
+        hi = word / 127773;
+        lo = word % 127773;
+        word = 16807 * lo - 2836 * hi;
+        if (word < 0) word += RNGMAX;
+        r->state[i] = word;
+    }
+    r->front = RNGSEP;
+    r->rear = 0;
+    for (i = 0; i < 10 * RNGDEG; i++) rngnext(r);
+}
+
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* isolate all random number generation in one location.  rngnext()         */
+/* returns an int in the range [0,mmm]                                      */
 /****************************************************************************/
-double jimsrand(void) {
-    double mmm = RAND_MAX; /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
+static double rngdraw(struct rng *r) {
+    double mmm = RNGMAX; /* largest int returned by rngnext() */
     double x;
-    x = rand() / mmm; /* x should be uniform in [0,1] */
+    x = rngnext(r) / mmm; /* x should be uniform in [0,1] */
     if (TRACE > 3) printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
     return (x);
 }
 
+static double jimsrand(void) { return (rngdraw(FLOWSTREAMS ? &cur->rng[2] : &rngmain)); }
+
+/* random number k (0..3) for the packet AorB is sending: loss, delay,
+   corruption, what to corrupt.  With split streams all four are drawn
+   when k == 0, whether or not the packet gets far enough to use them. */
+static double channelrand(int AorB, int k) {
+    static double draws[4];
+    struct rng *r;
+    int i;
+
+    if (FLOWSTREAMS) r = &cur->rng[AorB];
+    else if (splitstreams)
+        r = &rngchannel[AorB];
+    else
+        return (jimsrand());
+    if (k == 0)
+        for (i = 0; i < 4; i++) draws[i] = rngnext(r) / (double)RNGMAX;
+    return (draws[k]);
+}
+
+/* write v (mod STAMPMOD) as STAMPLEN printable base-64 digits */
+static void stamp(char *where, long v) {
+    int i;
+    v %= STAMPMOD;
+    for (i = STAMPLEN - 1; i >= 0; i--) {
+        where[i] = stampdigits[v & 63];
+        v >>= 6;
+    }
+}
+
+/* inverse of stamp(), returns -1 if a digit is not a valid stamp digit */
+static long unstamp(const char *where) {
+    long v = 0;
+    int i, d;
+    for (i = 0; i < STAMPLEN; i++) {
+        for (d = 0; d < 64 && stampdigits[d] != where[i]; d++) continue;
+        if (d == 64) return (-1);
+        v = (v << 6) | d;
+    }
+    return (v);
+}
+
+/* a delivery check failed: rdt exits, run_simulation() ends the run */
+static void failrun(void) {
+    if (!embedded) exit(EXIT_FAILURE);
+    runfailed = 1;
+}
+
+/* check a message delivered at B against the stream handed to A */
+static void verifydelivery(const char *data) {
+    long id, ord, expected;
+    int i;
+
+    id = unstamp(data + IDPOS);
+    ord = unstamp(data + ORDPOS);
+    for (i = 0; id >= 0 && i < IDPOS; i++)
+        if (data[i] != 97 + id % 26) id = -1;
+    if (id < 0 || ord < 0) {
+        printf("DELIVERY CHECK FAILED at time %f: corrupted message delivered to layer5", time);
+        if (nflows > 1) printf(" of flow %d", (int)(cur - flows));
+        printf(": ");
+        for (i = 0; i < 20; i++) printf("%c", data[i]);
+        printf("\n");
+        failrun();
+        return;
+    }
+    expected = cur->delivered % STAMPMOD;
+    if (ord != expected) {
+        printf("DELIVERY CHECK FAILED at time %f: delivered message %ld (ordinal %ld), expected ordinal %ld",
+               time, id, ord, expected);
+        if (ord < expected) printf(" - duplicate or out of order delivery");
+        else
+            printf(" - %ld accepted message(s) skipped", ord - expected);
+        printf(" (last message delivered: %ld", cur->lastdelivered);
+        if (nflows > 1) printf(", flow %d", (int)(cur - flows));
+        printf(")\n");
+        failrun();
+        return;
+    }
+    cur->lastdelivered = id;
+}
+
+#ifdef PROFILE
+static void profreport(void) {
+    long total = 0;
+    int i;
+
+    for (i = 0; i < 3; i++) total += profns[i];
+    printf("profile: event type       count     total ns   ns/event   share\n");
+    for (i = 0; i < 3; i++)
+        printf("profile: %-15s %9ld %12ld %10.1f %6.1f%%\n", profevname[i], profcount[i], profns[i],
+               profcount[i] ? (double)profns[i] / profcount[i] : 0.0, total ? 100.0 * profns[i] / total : 0.0);
+    printf("profile: max event list length: %ld\n", profmaxlist);
+    printf("profile: event list       calls      levels sifted   mean\n");
+    for (i = 0; i < 4; i++)
+        printf("profile: %-12s %9ld %18ld %6.1f\n", profscanname[i], profcalls[i], profsteps[i],
+               profcalls[i] ? (double)profsteps[i] / profcalls[i] : 0.0);
+}
+#endif
+
 /********************* EVENT HANDLINE ROUTINES *******/
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void insertevent(struct event *p) {
-    struct event *q, *qold;
+/* true if a is handled before b */
+static int evbefore(const struct event *a, const struct event *b) {
+    return (a->evtime < b->evtime || (a->evtime == b->evtime && a->seq > b->seq));
+}
+
+static void evplace(struct event *p, int pos) {
+    evheap[pos] = p;
+    p->heappos = pos;
+}
+
+/* restore the heap order for the event at pos, moving it up or down */
+static void evsift(int pos, int which) {
+    struct event *p = evheap[pos];
+    int child;
+
+    while (pos > 0 && evbefore(p, evheap[(pos - 1) / 2])) {
+        evplace(evheap[(pos - 1) / 2], pos);
+        pos = (pos - 1) / 2;
+        PROF_STEP(which);
+    }
+    while ((child = 2 * pos + 1) < nevlist) {
+        if (child + 1 < nevlist && evbefore(evheap[child + 1], evheap[child])) child++;
+        if (!evbefore(evheap[child], p)) break;
+        evplace(evheap[child], pos);
+        pos = child;
+        PROF_STEP(which);
+    }
+    evplace(p, pos);
+}
 
+/* put p on the event list, counting the call and the levels it is sifted
+   up as which's */
+static void scheduleevent(struct event *p, int which) {
     if (TRACE > 2) {
         printf("            INSERTEVENT: time is %f\n", time);
         printf("            INSERTEVENT: future time will be %f\n", p->evtime);
     }
-    q = evlist;      /* q points to front of list in which p struct inserted */
-    if (q == NULL) { /* list is empty */
-        evlist = p;
-        p->next = NULL;
-        p->prev = NULL;
-    } else {
-        for (qold = q; q != NULL && p->evtime > q->evtime; q = q->next) qold = q;
-        if (q == NULL) { /* end of list */
-            qold->next = p;
-            p->prev = qold;
-            p->next = NULL;
-        } else if (q == evlist) { /* front of list */
-            p->next = evlist;
-            p->prev = NULL;
-            p->next->prev = p;
-            evlist = p;
-        } else { /* middle of list */
-            p->next = q;
-            p->prev = q->prev;
-            q->prev->next = p;
-            q->prev = p;
-        }
-    }
-}
-
-void generate_next_arrival(void) {
+    PROF_CALL(which);
+    PROF_LISTLEN(1);
+    if (nevlist == evheapsize) {
+        evheapsize = evheapsize == 0 ? 64 : 2 * evheapsize;
+        evheap = realloc(evheap, evheapsize * sizeof(struct event *));
+        if (evheap == 0) {
+            printf("memory allocation for event list failed.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    p->seq = evseq++;
+    evplace(p, nevlist++);
+    evsift(p->heappos, which);
+}
+
+static void insertevent(struct event *p) { scheduleevent(p, SCAN_INSERT); }
+
+/* take p off the event list */
+static void removeevent(struct event *p, int which) {
+    int pos = p->heappos;
+
+    PROF_LISTLEN(-1);
+    if (pos != --nevlist) {
+        evplace(evheap[nevlist], pos);
+        evsift(pos, which);
+    }
+}
+
+/* remove and return the next event, NULL if there is none */
+static struct event *nextevent(void) {
+    struct event *p;
+
+    if (nevlist == 0) return (NULL);
+    p = evheap[0];
+    removeevent(p, SCAN_INSERT);
+    return (p);
+}
+
+/* make f the flow the protocol routines and the calls they make act on */
+static void selectflow(int f) {
+    cur = &flows[f];
+    proto->setflow(flowstate + (size_t)f * proto->flowsize);
+}
+
+/* (re)allocate zeroed state for nflows flows of the current protocol */
+static void allocflows(void) {
+    int f;
+
+    free(flows);
+    free(flowstate);
+    flows = calloc(nflows, sizeof(struct flow));
+    flowstate = calloc(nflows, proto->flowsize);
+    if (flows == 0 || flowstate == 0) {
+        printf("memory allocation for %d flows failed.", nflows);
+        exit(EXIT_FAILURE);
+    }
+    for (f = 0; f < nflows; f++) flows[f].lastdelivered = -1;
+    selectflow(0);
+}
+
+static void generate_next_arrival(void) {
     double x;
     struct event *evptr;
 
@@ -149,26 +496,15 @@ void generate_next_arrival(void) {
     }
     evptr->evtime = time + x;
     evptr->evtype = FROM_LAYER5;
+    evptr->flow = cur - flows;
     if (BIDIRECTIONAL && (jimsrand() > 0.5)) evptr->eventity = B;
     else
         evptr->eventity = A;
     insertevent(evptr);
 }
 
-void printevlist(void) {
-    struct event *q;
-    printf("--------------\nEvent List Follows:\n");
-    for (q = evlist; q != NULL; q = q->next) {
-        printf("Event time: %f, type: %d entity: %d\n", q->evtime, q->evtype, q->eventity);
-    }
-    printf("--------------\n");
-}
-
-void init(void) /* initialize the simulator */
+static void init(void) /* initialize the simulator */
 {
-    float sum, avg;
-    int i;
-
     printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
     printf("Enter the number of messages to simulate: ");
     scanf("%d", &nsimmax);
@@ -185,10 +521,20 @@ void init(void) /* initialize the simulator */
     scanf("%f", &lambda);
     printf("Enter TRACE:");
     scanf("%d", &TRACE);
+}
+
+/* start a run: seed the random number generators, reset the statistics */
+/* and put the first arrival on the event list */
+static void initrun(void) {
+    float sum, avg;
+    int i;
 
-    srand(9999);                                  /* init random number generator */
-    sum = 0.0;                                    /* test random number generator for students */
-    for (i = 0; i < 1000; i++) sum += jimsrand(); /* jimsrand() should be uniform in [0,1] */
+    rngseed(&rngmain, seed); /* init random number generator */
+    allocflows();
+    for (i = 0; FLOWSTREAMS && i < 3 * nflows; i++)
+        rngseed(&flows[i / 3].rng[i % 3], seed * 2654435761u + 3 + i);
+    sum = 0.0;                                            /* test random number generator for students */
+    for (i = 0; i < 1000; i++) sum += rngdraw(&rngmain); /* jimsrand() should be uniform in [0,1] */
     avg = sum / 1000.0;
     if (avg < 0.25 || avg > 0.75) {
         printf("It is likely that random number generation on your machine\n");
@@ -196,9 +542,12 @@ void init(void) /* initialize the simulator */
         printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
         exit(EXIT_FAILURE);
     }
+    for (i = 0; i < 2; i++) rngseed(&rngchannel[i], seed * 2654435761u + 1 + i);
 
     /* initialise statistics */
     window_full = 0;
+    cwnd_cuts = 0;
+    nak_resends = 0;
     total_ACKs_received = 0;
     packets_resent = 0;
     new_ACKs = 0;
@@ -212,9 +561,20 @@ void init(void) /* initialize the simulator */
     ntolayer3 = 0;
     nlost = 0;
     ncorrupt = 0;
+    nevents = 0;
+    nsim = 0;
+    bnfree = 0.0;
+    bndrops = 0;
+    inflight[A] = inflight[B] = 0;
+    nsamples = 0;
+    evseq = 0;
+    nlinkq = 0;
 
-    time = 0.0;              /* initialize time to 0.0 */
-    generate_next_arrival(); /* initialize event list */
+    time = 0.0; /* initialize time to 0.0 */
+    for (i = 0; i < nflows; i++) { /* initialize event list */
+        selectflow(i);
+        generate_next_arrival();
+    }
 }
 
 /********************** Student-callable ROUTINES ***********************/
@@ -223,45 +583,29 @@ void init(void) /* initialize the simulator */
 void stoptimer(int AorB)
 /* A or B is trying to stop timer */
 {
-    struct event *q;
-
     if (TRACE > 1) printf("          STOP TIMER: stopping timer at %f\n", time);
-    /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-    for (q = evlist; q != NULL; q = q->next)
-        if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB)) {
-            /* remove this event */
-            if (q->next == NULL && q->prev == NULL)
-                evlist = NULL;        /* remove first and only event on list */
-            else if (q->next == NULL) /* end of list - there is one in front */
-                q->prev->next = NULL;
-            else if (q == evlist) { /* front of list - there must be event after */
-                q->next->prev = NULL;
-                evlist = q->next;
-            } else { /* middle of list */
-                q->next->prev = q->prev;
-                q->prev->next = q->next;
-            }
-            free(q);
-            return;
-        }
-    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    PROF_CALL(SCAN_STOP);
+    if (cur->timer[AorB] == NULL) {
+        printf("Warning: unable to cancel your timer. It wasn't running.\n");
+        return;
+    }
+    removeevent(cur->timer[AorB], SCAN_STOP);
+    free(cur->timer[AorB]);
+    cur->timer[AorB] = NULL;
 }
 
 void starttimer(int AorB, double increment)
 /* A or B is trying to start timer */
 {
 
-    struct event *q;
     struct event *evptr;
 
     if (TRACE > 1) printf("          START TIMER: starting timer at %f\n", time);
     /* be nice: check to see if timer is already started, if so, then  warn */
-    /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-    for (q = evlist; q != NULL; q = q->next)
-        if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB)) {
-            printf("Warning: attempt to start a timer that is already started\n");
-            return;
-        }
+    if (cur->timer[AorB] != NULL) {
+        printf("Warning: attempt to start a timer that is already started\n");
+        return;
+    }
 
     /* create future event for when timer goes off */
     evptr = malloc(sizeof(struct event));
@@ -273,28 +617,67 @@ void starttimer(int AorB, double increment)
     evptr->evtype = TIMER_INTERRUPT;
 
     evptr->eventity = AorB;
-    insertevent(evptr);
+    evptr->flow = cur - flows;
+    cur->timer[AorB] = evptr;
+    if (AorB == A) cur->rto = increment;
+    scheduleevent(evptr, SCAN_START);
+}
+
+/* the bottleneck: queue a packet A sends now behind the packets still
+   waiting, or drop it.  1 with *departs set to when it leaves the link,
+   0 if dropped. */
+static int bottleneck(float *departs) {
+    if (bnfree < time) bnfree = time;
+    if ((bnfree - time) * bnrate > bnqueue) {
+        bndrops++;
+        if (TRACE > 0) printf("          TOLAYER3: packet dropped at the bottleneck\n");
+        return (0);
+    }
+    bnfree += 1 / bnrate;
+    *departs = bnfree;
+    return (1);
 }
 
+/* arrival time at entity to of a packet of flow cur that can leave at
+   lastime, delay being its delay draw.  medium can not reorder, so make sure
+   packet arrives between 1 and 10 time units after the latest arrival time
+   of packets currently in the medium on their way to the destination */
+static float arrivaltime(int to, float lastime, double delay) {
+    if (cur->lastarrival[to] > lastime) lastime = cur->lastarrival[to];
+    cur->lastarrival[to] = lastime + 1 + 9 * delay;
+    return (cur->lastarrival[to]);
+}
+
+static void linkqueue(const struct event *evptr, double delay);
+static void linkflush(void);
+static void naksent(int seqnum);
+
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
+void tolayer3(int AorB, const struct pkt *packet)
 /* A or B is sending to network  */
 {
     struct pkt *mypktptr;
-    struct event *evptr, *q;
+    struct event *evptr;
     float lastime, x;
+    double delay;
+    int linked; /* the bottleneck is done in link order, see PARTITIONS */
     int i;
 
     ntolayer3++;
+    if (naks && AorB == B && packet->seqnum == NAK) naksent(packet->acknum);
 
     /* simulate losses: */
-    if (jimsrand() < lossprob &&
+    if (channelrand(AorB, 0) < lossprob &&
         (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
         nlost++;
         if (TRACE > 0) printf("          TOLAYER3: packet being lost\n");
         return;
     }
 
+    lastime = time;
+    linked = AorB == A && bnrate > 0 && FLOWSTREAMS;
+    if (AorB == A && bnrate > 0 && !linked && !bottleneck(&lastime)) return;
+
     /* make a copy of the packet student just gave me since he/she may decide */
     /* to do something with the packet after we return back to him/her */
     mypktptr = malloc(sizeof(struct pkt));
@@ -302,10 +685,7 @@ void tolayer3(int AorB, struct pkt packet)
         printf("memory allocation for event failed.");
         exit(EXIT_FAILURE);
     }
-    mypktptr->seqnum = packet.seqnum;
-    mypktptr->acknum = packet.acknum;
-    mypktptr->checksum = packet.checksum;
-    for (i = 0; i < 20; i++) mypktptr->payload[i] = packet.payload[i];
+    *mypktptr = *packet;
     if (TRACE > 2) {
         printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
                mypktptr->acknum, mypktptr->checksum);
@@ -322,21 +702,16 @@ void tolayer3(int AorB, struct pkt packet)
     evptr->evtype = FROM_LAYER3;      /* packet will pop out from layer3 */
     evptr->eventity = (AorB + 1) % 2; /* event occurs at other entity */
     evptr->pktptr = mypktptr;         /* save ptr to my copy of packet */
-    /* finally, compute the arrival time of packet at the other end.
-       medium can not reorder, so make sure packet arrives between 1 and 10
-       time units after the latest arrival time of packets
-       currently in the medium on their way to the destination */
-    lastime = time;
-    /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-    for (q = evlist; q != NULL; q = q->next)
-        if ((q->evtype == FROM_LAYER3 && q->eventity == evptr->eventity)) lastime = q->evtime;
-    evptr->evtime = lastime + 1 + 9 * jimsrand();
+    evptr->flow = cur - flows;
+    /* finally, compute the arrival time of packet at the other end */
+    delay = channelrand(AorB, 1);
+    if (!linked) evptr->evtime = arrivaltime(evptr->eventity, lastime, delay);
 
     /* simulate corruption: */
-    if ((jimsrand() < corruptprob) &&
+    if ((channelrand(AorB, 2) < corruptprob) &&
         (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
         ncorrupt++;
-        if ((x = jimsrand()) < .75) mypktptr->payload[0] = 'Z'; /* corrupt payload */
+        if ((x = channelrand(AorB, 3)) < .75) mypktptr->payload[0] = 'Z'; /* corrupt payload */
         else if (x < .875)
             mypktptr->seqnum = 999999;
         else
@@ -344,11 +719,18 @@ void tolayer3(int AorB, struct pkt packet)
         if (TRACE > 0) printf("          TOLAYER3: packet being corrupted\n");
     }
 
+    if (linked) { /* corrupted or not, it may still be dropped */
+        linkqueue(evptr, delay);
+        free(mypktptr);
+        free(evptr);
+        return;
+    }
     if (TRACE > 2) printf("          TOLAYER3: scheduling arrival on other side\n");
-    insertevent(evptr);
+    inflight[evptr->eventity]++;
+    scheduleevent(evptr, SCAN_TOLAYER3);
 }
 
-void tolayer5(int AorB, char datasent[20]) {
+void tolayer5(int AorB, const char datasent[20]) {
     int i;
     if (TRACE > 2) {
         printf("          TOLAYER5: data received by application at ");
@@ -358,25 +740,320 @@ void tolayer5(int AorB, char datasent[20]) {
         for (i = 0; i < 20; i++) printf("%c", datasent[i]);
         printf("\n");
     }
+    if (AorB == B) verifydelivery(datasent);
     messages_delivered++;
+    cur->delivered++;
+}
+
+/* only A's window is recorded, B does not send data */
+void setcwnd(int AorB, double cwnd) {
+    if (AorB != A) return;
+    if (TRACE > 2) printf("          SETCWND: congestion window %f at %f\n", cwnd, time);
+    cur->cwndarea += cur->cwnd * (time - cur->cwndsince);
+    cur->cwnd = cwnd;
+    cur->cwndsince = time;
+}
+
+/* B sent a NAK for packet seqnum: time it until the packet arrives */
+static void naksent(int seqnum) {
+    int i;
+
+    cur->naks++;
+    for (i = 0; i < cur->npending; i++)
+        if (cur->nakseq[i] == seqnum) return; /* timed from the first NAK */
+    if (cur->npending == NAKWAIT) {
+        cur->npending--;
+        memmove(cur->nakseq, cur->nakseq + 1, cur->npending * sizeof(int));
+        memmove(cur->naktime, cur->naktime + 1, cur->npending * sizeof(float));
+    }
+    cur->nakseq[cur->npending] = seqnum;
+    cur->naktime[cur->npending++] = time;
+}
+
+/* an intact packet arrives at B: the end of a recovery if it was NAKed */
+static void nakrecovered(const struct pkt *packet) {
+    float t;
+    int i;
+
+    for (i = 0; i < cur->npending; i++)
+        if (cur->nakseq[i] == packet->seqnum) {
+            t = time - cur->naktime[i];
+            cur->recovered++;
+            cur->recoverysum += t;
+            if (t > cur->recoverymax) cur->recoverymax = t;
+            cur->npending--;
+            memmove(cur->nakseq + i, cur->nakseq + i + 1, (cur->npending - i) * sizeof(int));
+            memmove(cur->naktime + i, cur->naktime + i + 1, (cur->npending - i) * sizeof(float));
+            return;
+        }
+}
+
+/* A's congestion window of flow f averaged over the run so far */
+static double meancwnd(const struct flow *f) {
+    if (time <= 0) return (f->cwnd);
+    return ((f->cwndarea + f->cwnd * (time - f->cwndsince)) / time);
+}
+
+/****************************** SAMPLER *******************************/
+
+static void opensamples(const char *path, int append) {
+    if ((samplefp = fopen(path, append ? "a" : "w")) == NULL) {
+        printf("unable to open sample file %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    setvbuf(samplefp, samplebuf, _IOFBF, sizeof(samplebuf));
+    if (!append) fprintf(samplefp, "run,time,unacked,inflight_ab,inflight_ba,delivered,resent,rto,cwnd\n");
+}
+
+/* one line for time t: packets A is waiting to see ACKed, packets in the
+   channel each way, messages delivered and packets resent so far, and A's
+   timeout and congestion window (empty for a fixed window); with several
+   flows the first two are totals and the last two means over the flows */
+static void writesample(float t) {
+    struct flow *was = cur;
+    double rto = 0.0, cwnd = 0.0;
+    int f, unacked = 0;
+
+    for (f = 0; f < nflows; f++) {
+        selectflow(f);
+        unacked += proto->unacked();
+        rto += cur->rto;
+        cwnd += cur->cwnd;
+    }
+    selectflow(was - flows);
+    fprintf(samplefp, "%s,%.3f,%d,%d,%d,%d,%d,%.3f,", samplerun, t, unacked, inflight[B], inflight[A],
+            messages_delivered, packets_resent, rto / nflows);
+    if (congestion) fprintf(samplefp, "%.3f", cwnd / nflows);
+    fprintf(samplefp, "\n");
 }
 
-int main(void) {
+static void closesamples(void) {
+    if (samplefp == NULL) return;
+    if (ferror(samplefp) | fclose(samplefp)) printf("Warning: unable to write all samples\n");
+    samplefp = NULL;
+}
+
+/********************** CHECKPOINT / RESUME ***********************/
+/* A checkpoint is the complete simulator state in a compact binary file:
+   a magic string, the run as named on -p, the emulator variables listed
+   below, the event heap (with the packets of FROM_LAYER3 events), the
+   flows and finally every flow's protocol state block.  The file is native-endian and meant to
+   be resumed by the same binary.  Because the random number generator state
+   is included, a resumed run continues bit-exactly. */
+#define CKPTMAGIC "RDTCKP10"
+#define CKPTNAMELEN sizeof(ckptrun) /* bytes for the run name */
+
+static const struct {
+    void *ptr;
+    size_t size;
+} ckptstate[] = {
+    {&time, sizeof(time)},
+    {&nsim, sizeof(nsim)},
+    {&nsimmax, sizeof(nsimmax)},
+    {&lossprob, sizeof(lossprob)},
+    {&corruptprob, sizeof(corruptprob)},
+    {&corruptdirection, sizeof(corruptdirection)},
+    {&lambda, sizeof(lambda)},
+    {&TRACE, sizeof(TRACE)},
+    {&ntolayer3, sizeof(ntolayer3)},
+    {&nlost, sizeof(nlost)},
+    {&ncorrupt, sizeof(ncorrupt)},
+    {&window_full, sizeof(window_full)},
+    {&cwnd_cuts, sizeof(cwnd_cuts)},
+    {&congestion, sizeof(congestion)},
+    {&naks, sizeof(naks)},
+    {&nak_resends, sizeof(nak_resends)},
+    {&sendwindow, sizeof(sendwindow)},
+    {&sendrtt, sizeof(sendrtt)},
+    {&total_ACKs_received, sizeof(total_ACKs_received)},
+    {&packets_resent, sizeof(packets_resent)},
+    {&new_ACKs, sizeof(new_ACKs)},
+    {&packets_received, sizeof(packets_received)},
+    {&packets_lost, sizeof(packets_lost)},
+    {&packets_corrupt, sizeof(packets_corrupt)},
+    {&packets_sent, sizeof(packets_sent)},
+    {&packets_timeout, sizeof(packets_timeout)},
+    {&messages_delivered, sizeof(messages_delivered)},
+    {&nevents, sizeof(nevents)},
+    {&evseq, sizeof(evseq)},
+    {&nflows, sizeof(nflows)},
+    {&bnrate, sizeof(bnrate)},
+    {&bnqueue, sizeof(bnqueue)},
+    {&bnfree, sizeof(bnfree)},
+    {&bndrops, sizeof(bndrops)},
+    {inflight, sizeof(inflight)},
+    {&nsamples, sizeof(nsamples)},
+    {&rngmain, sizeof(rngmain)},
+    {rngchannel, sizeof(rngchannel)},
+    {&splitstreams, sizeof(splitstreams)},
+    {&seed, sizeof(seed)},
+};
+#define NCKPTSTATE (sizeof(ckptstate) / sizeof(ckptstate[0]))
+
+/* write the checkpoint to path.tmp and rename it over path, so an
+   interrupted write never destroys the previous checkpoint */
+static int writecheckpoint(const char *path) {
+    char tmp[FILENAME_MAX];
+    char name[CKPTNAMELEN];
+    struct event *q;
+    FILE *fp;
+    size_t i;
+    int ok;
+
+    if (strlen(path) + 5 > sizeof(tmp)) return (-1);
+    sprintf(tmp, "%s.tmp", path);
+    if ((fp = fopen(tmp, "wb")) == NULL) return (-1);
+    memset(name, 0, sizeof(name));
+    strncpy(name, samplerun != NULL ? samplerun : proto->name, sizeof(name) - 1);
+    ok = fwrite(CKPTMAGIC, sizeof(CKPTMAGIC), 1, fp) == 1 && fwrite(name, sizeof(name), 1, fp) == 1;
+    for (i = 0; ok && i < NCKPTSTATE; i++) ok = fwrite(ckptstate[i].ptr, ckptstate[i].size, 1, fp) == 1;
+    ok = ok && fwrite(&nevlist, sizeof(nevlist), 1, fp) == 1;
+    for (i = 0; ok && i < (size_t)nevlist; i++) {
+        q = evheap[i];
+        ok = fwrite(&q->evtime, sizeof(q->evtime), 1, fp) == 1 && fwrite(&q->evtype, sizeof(q->evtype), 1, fp) == 1 &&
+             fwrite(&q->eventity, sizeof(q->eventity), 1, fp) == 1 && fwrite(&q->flow, sizeof(q->flow), 1, fp) == 1 &&
+             fwrite(&q->seq, sizeof(q->seq), 1, fp) == 1;
+        if (ok && q->evtype == FROM_LAYER3) ok = fwrite(q->pktptr, sizeof(struct pkt), 1, fp) == 1;
+    }
+    /* timer pointers are rebuilt from the heap on reading */
+    ok = ok && fwrite(flows, sizeof(struct flow), nflows, fp) == (size_t)nflows;
+    ok = ok && fwrite(flowstate, proto->flowsize, nflows, fp) == (size_t)nflows;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp, path) != 0) {
+        remove(tmp);
+        return (-1);
+    }
+    if (TRACE > 1) printf("          CHECKPOINT: state at time %f written to %s\n", time, path);
+    return (0);
+}
+
+/* restore the state written by writecheckpoint(), and select the protocol
+   that wrote it, in place of init(); ckptrun is set to the run's name.  Its
+   options come back with congestion and naks. */
+static int readcheckpoint(const char *path) {
+    char magic[sizeof(CKPTMAGIC)];
+    struct event *p;
+    FILE *fp;
+    size_t i;
+    int n, f;
+    int ok, options;
+
+    if ((fp = fopen(path, "rb")) == NULL) return (-1);
+    ok = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, CKPTMAGIC, sizeof(magic)) == 0 &&
+         fread(ckptrun, sizeof(ckptrun), 1, fp) == 1;
+    if (ok) {
+        ckptrun[sizeof(ckptrun) - 1] = '\0';
+        if ((proto = selectprotocol(ckptrun, &options)) == NULL) {
+            printf("checkpoint %s was written by unknown protocol %s\n", path, ckptrun);
+            ok = 0;
+        }
+    }
+    for (i = 0; ok && i < NCKPTSTATE; i++) ok = fread(ckptstate[i].ptr, ckptstate[i].size, 1, fp) == 1;
+    ok = ok && fread(&n, sizeof(n), 1, fp) == 1 && n >= 0 && nflows > 0;
+    if (ok) allocflows();
+    for (nevlist = 0; ok && nevlist < n; nevlist++) {
+        if (nevlist == evheapsize) {
+            evheapsize = evheapsize == 0 ? 64 : 2 * evheapsize;
+            evheap = realloc(evheap, evheapsize * sizeof(struct event *));
+            if (evheap == 0) {
+                printf("memory allocation for event list failed.");
+                exit(EXIT_FAILURE);
+            }
+        }
+        p = malloc(sizeof(struct event));
+        if (p == 0) {
+            printf("memory allocation for event failed.");
+            exit(EXIT_FAILURE);
+        }
+        ok = fread(&p->evtime, sizeof(p->evtime), 1, fp) == 1 && fread(&p->evtype, sizeof(p->evtype), 1, fp) == 1 &&
+             fread(&p->eventity, sizeof(p->eventity), 1, fp) == 1 && fread(&p->flow, sizeof(p->flow), 1, fp) == 1 &&
+             fread(&p->seq, sizeof(p->seq), 1, fp) == 1 && p->flow >= 0 && p->flow < nflows;
+        p->pktptr = NULL;
+        if (ok && p->evtype == FROM_LAYER3) {
+            p->pktptr = malloc(sizeof(struct pkt));
+            if (p->pktptr == 0) {
+                printf("memory allocation for event failed.");
+                exit(EXIT_FAILURE);
+            }
+            ok = fread(p->pktptr, sizeof(struct pkt), 1, fp) == 1;
+        }
+        evplace(p, nevlist); /* the heap was written as it was */
+    }
+    ok = ok && fread(flows, sizeof(struct flow), nflows, fp) == (size_t)nflows;
+    ok = ok && fread(flowstate, proto->flowsize, nflows, fp) == (size_t)nflows;
+    for (f = 0; ok && f < nflows; f++) flows[f].timer[A] = flows[f].timer[B] = NULL;
+    for (n = 0; ok && n < nevlist; n++)
+        if (evheap[n]->evtype == TIMER_INTERRUPT) flows[evheap[n]->flow].timer[evheap[n]->eventity] = evheap[n];
+    fclose(fp);
+    if (ok && TRACE > 0) printf("Resuming from checkpoint %s at time %f\n", path, time);
+    return (ok ? 0 : -1);
+}
+
+static void usage(const char *prog) {
+    int i;
+
+    printf("usage: %s [-p protocol[,protocol...]] [-f flows] [-b rate [-q packets]] [-P n]\n"
+           "       [-s interval -o samples.csv] [-c checkpoint-file [-i events]] [-r checkpoint-file]\n"
+           "       [-R n [-w frac]] [-j n] [-W window] [-t rtt] [-T budget]\n",
+           prog);
+    printf("  -p names  protocol(s) to run (default %s); several are run one after the other\n", DEFAULT_PROTOCOL);
+    printf("            against the same arrivals and channel, and compared; name:aimd gives\n");
+    printf("            the sender an AIMD congestion window instead of the fixed window (gbn, sr),\n");
+    printf("            name:nak has the receiver send NAKs for gaps (gbn, sr); both: name:aimd:nak\n");
+    printf("  -f flows  simulate flows A->B connections (default 1), each sending the number of\n");
+    printf("            messages asked for; the report adds per-flow goodput and fairness\n");
+    printf("  -b rate   the flows' A->B packets share a link sending rate packets per time unit\n");
+    printf("  -q n      packets that can wait for the shared link, the rest are dropped (default 64)\n");
+    printf("  -P n      spread the flows over n processes; the results are those of the ordinary\n");
+    printf("            run, whatever n\n");
+    printf("  -R n      run n independent replications (seeds %u, %u, ...) in parallel and report\n", seed, seed + 1);
+    printf("            means with 95%% confidence intervals\n");
+    printf("  -w frac   stop replicating once the goodput's interval is within frac of its mean\n");
+    printf("  -j n      replications or tuning runs at once (default: the number of processors)\n");
+    printf("  -W n      A's window, n packets instead of the engine's WINDOWSIZE (at most that)\n");
+    printf("  -t rtt    A's timeout, rtt time units instead of the engine's RTT\n");
+    printf("  -T b      tune: search the window and timeout giving the highest goodput with at\n");
+    printf("            most b packets resent per message delivered; -R seeds per candidate\n");
+    printf("            (default 4); make tune builds rdt for windows up to 64 packets\n");
+    printf("  -s t      every t time units, append the senders' unacked packets, packets in\n");
+    printf("            flight, delivered and resent counts, timeout and cwnd to the -o file\n");
+    printf("  -o file   CSV file the -s samples go to (a resumed run appends to it)\n");
+    printf("  -c file   write a checkpoint to file every -i events (default 1000000)\n");
+    printf("  -r file   resume the simulation saved in file instead of asking for parameters\n");
+    printf("protocols:");
+    for (i = 0; protocols[i] != NULL; i++) printf(" %s", protocols[i]->name);
+    printf("\n");
+    exit(EXIT_FAILURE);
+}
+
+/* run until the event list is empty or its next event is at or after
+   until, writing a checkpoint to ckptfile (if not NULL) every ckptevery
+   events */
+static void simulate(const char *ckptfile, long ckptevery, float until) {
     struct event *eventptr;
     struct msg msg2give;
-    struct pkt pkt2give;
+    long nextckpt;
+    int wasfull, wasresent;
 
     int i, j;
 
-    init();
-    A_init();
-    B_init();
+    nextckpt = (nevents / ckptevery + 1) * ckptevery;
 
     while (1) {
-        eventptr = evlist; /* get next event to simulate */
-        if (eventptr == NULL) goto terminate;
-        evlist = evlist->next; /* remove this event from event list */
-        if (evlist != NULL) evlist->prev = NULL;
+        /* the packets sent at this time go to the link once time moves on */
+        if (nlinkq > 0 && nparts == 0 && (nevlist == 0 || evheap[0]->evtime > time)) linkflush();
+        if (ckptfile != NULL && nevents >= nextckpt && nlinkq == 0) {
+            if (samplefp != NULL) fflush(samplefp); /* a resumed run appends after these */
+            if (writecheckpoint(ckptfile) != 0) printf("Warning: unable to write checkpoint %s\n", ckptfile);
+            nextckpt += ckptevery;
+        }
+        if (runfailed || (nevlist > 0 && evheap[0]->evtime >= until)) return;
+        eventptr = nextevent(); /* get next event to simulate */
+        if (eventptr == NULL) return;
+        while (samplefp != NULL && nsamples * sampleevery <= eventptr->evtime) {
+            writesample(nsamples * sampleevery);
+            nsamples++;
+        }
         if (TRACE >= 2) {
             printf("\nEVENT time: %f,", eventptr->evtime);
             printf("  type: %d", eventptr->evtype);
@@ -385,47 +1062,115 @@ int main(void) {
                 printf(", fromlayer5 ");
             else
                 printf(", fromlayer3 ");
-            printf(" entity: %d\n", eventptr->eventity);
+            printf(" entity: %d", eventptr->eventity);
+            if (nflows > 1) printf(" flow: %d", eventptr->flow);
+            printf("\n");
         }
         time = eventptr->evtime; /* update time to next event time */
+        nevents++;
+        PROF_EVENT_BEGIN();
+        selectflow(eventptr->flow);
+        wasfull = window_full;
+        wasresent = packets_resent;
         if (eventptr->evtype == FROM_LAYER5) {
-            if (nsim < nsimmax) {
+            if (cur->nsim < nsimmax) {
                 generate_next_arrival(); /* set up future arrival */
-                /* fill in msg to give with string of same letter */
-                j = nsim % 26;
-                for (i = 0; i < 20; i++) msg2give.data[i] = 97 + j;
+                /* fill in msg to give with string of same letter, stamped with */
+                /* the message id and its ordinal among accepted messages */
+                j = cur->nsim % STAMPMOD % 26; /* verifydelivery() sees the id stamp */
+                for (i = 0; i < IDPOS; i++) msg2give.data[i] = 97 + j;
+                stamp(msg2give.data + IDPOS, cur->nsim);
+                stamp(msg2give.data + ORDPOS, cur->nsim - cur->window_full);
                 if (TRACE > 2) {
                     printf("          MAINLOOP: data given to student: ");
                     for (i = 0; i < 20; i++) printf("%c", msg2give.data[i]);
                     printf("\n");
                 }
                 nsim++;
-                if (eventptr->eventity == A) A_output(msg2give);
+                cur->nsim++;
+                if (eventptr->eventity == A) proto->A_output(msg2give);
                 else
-                    B_output(msg2give);
+                    proto->B_output(msg2give);
             } else if (TRACE > 2)
                 printf("          FROM_LAYER5: no more messages to send: \n");
         } else if (eventptr->evtype == FROM_LAYER3) {
-            pkt2give.seqnum = eventptr->pktptr->seqnum;
-            pkt2give.acknum = eventptr->pktptr->acknum;
-            pkt2give.checksum = eventptr->pktptr->checksum;
-            for (i = 0; i < 20; i++) pkt2give.payload[i] = eventptr->pktptr->payload[i];
-            if (eventptr->eventity == A) /* deliver packet by calling */
-                A_input(pkt2give);       /* appropriate entity */
+            inflight[eventptr->eventity]--;
+            if (eventptr->eventity == B && cur->npending > 0 && !IsCorrupted(eventptr->pktptr))
+                nakrecovered(eventptr->pktptr);
+            if (eventptr->eventity == A)   /* deliver packet by calling */
+                proto->A_input(eventptr->pktptr); /* appropriate entity, no copy */
             else
-                B_input(pkt2give);
+                proto->B_input(eventptr->pktptr);
             free(eventptr->pktptr); /* free the memory for packet */
         } else if (eventptr->evtype == TIMER_INTERRUPT) {
-            if (eventptr->eventity == A) A_timerinterrupt();
+            cur->timer[eventptr->eventity] = NULL;
+            if (eventptr->eventity == A) proto->A_timerinterrupt();
             else
-                B_timerinterrupt();
+                proto->B_timerinterrupt();
         } else {
             printf("INTERNAL PANIC: unknown event type \n");
         }
+        cur->window_full += window_full - wasfull;
+        cur->resent += packets_resent - wasresent;
+        PROF_EVENT_END(eventptr->evtype);
         free(eventptr);
     }
+}
+
+/* per-flow goodput (messages delivered per time unit), its spread and
+   Jain's fairness index (sum x)^2 / (n sum x^2): 1 when every flow gets the
+   same goodput, 1/n when one flow gets everything */
+static void reportflows(void) {
+    double x, sum = 0.0, sumsq = 0.0, min = 0.0, max = 0.0;
+    int f;
+
+    printf("flow      sent  window_full   resent  delivered    goodput%s\n", congestion ? "  mean cwnd" : "");
+    for (f = 0; f < nflows; f++) {
+        x = time > 0 ? flows[f].delivered / time : 0.0;
+        printf("%-6d %7d %12d %8d %10d %10.4f", f, flows[f].nsim, flows[f].window_full, flows[f].resent,
+               flows[f].delivered, x);
+        if (congestion) printf(" %10.2f", meancwnd(&flows[f]));
+        printf("\n");
+        sum += x;
+        sumsq += x * x;
+        if (f == 0 || x < min) min = x;
+        if (f == 0 || x > max) max = x;
+    }
+    printf("aggregate goodput over %d flows:  %f (per flow: min %f, mean %f, max %f)\n", nflows, sum, min,
+           sum / nflows, max);
+    printf("Jain fairness index:  %f \n", sumsq > 0 ? sum * sum / (nflows * sumsq) : 1.0);
+}
+
+/* A's congestion window averaged over the run and over the flows */
+static double allcwnd(void) {
+    double sum = 0.0;
+    int f;
+
+    for (f = 0; f < nflows; f++) sum += meancwnd(&flows[f]);
+    return (sum / nflows);
+}
+
+/* NAKs sent over the flows, and the mean and longest time from a NAK to the
+   packet it asked for arriving at B (0 if none did) */
+static int allnaks(double *mean, double *max) {
+    double sum = 0.0;
+    int f, n = 0, recovered = 0;
+
+    *max = 0.0;
+    for (f = 0; f < nflows; f++) {
+        n += flows[f].naks;
+        recovered += flows[f].recovered;
+        sum += flows[f].recoverysum;
+        if (flows[f].recoverymax > *max) *max = flows[f].recoverymax;
+    }
+    *mean = recovered > 0 ? sum / recovered : 0.0;
+    return (n);
+}
+
+/* print the end of run statistics, 0 if every accepted message was delivered */
+static int report(void) {
+    double mean, max;
 
-terminate:
     printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",
            time, nsim);
     printf("number of messages dropped due to full window:  %d \n", window_full);
@@ -436,5 +1181,937 @@ terminate:
     printf("number of packet resends by A:  %d \n", packets_resent);
     printf("number of correct packets received at B:  %d \n", packets_received);
     printf("number of messages delivered to application:  %d \n", messages_delivered);
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+    if (bnrate > 0) printf("number of packets dropped at the bottleneck:  %d \n", bndrops);
+    if (congestion) {
+        printf("number of congestion window decreases:  %d \n", cwnd_cuts);
+        printf("time averaged congestion window of A:  %f \n", allcwnd());
+    }
+    if (naks) {
+        printf("number of NAKs sent by B:  %d \n", allnaks(&mean, &max));
+        printf("number of packet resends by A on a NAK:  %d \n", nak_resends);
+        printf("time from NAK to the packet arriving at B:  mean %f, max %f \n", mean, max);
+    }
+    if (nflows > 1) reportflows();
+    PROF_REPORT();
+    if (messages_delivered != nsim - window_full) {
+        printf("DELIVERY CHECK FAILED: %d accepted message(s) never delivered\n",
+               nsim - window_full - messages_delivered);
+        return (-1);
+    }
+    return (0);
+}
+
+/* the results of a run, as the replication and comparison tables use them */
+#define M_TIME 0
+#define M_SENT 1
+#define M_FULL 2
+#define M_NEWACKS 3
+#define M_RESENT 4
+#define M_RECEIVED 5
+#define M_DELIVERED 6
+#define M_GOODPUT 7
+#define M_BNDROPS 8
+#define M_CWNDCUTS 9
+#define M_CWND 10
+#define M_NAKRESENT 11
+#define M_RECOVERY 12
+#define NMETRICS 13
+static const char *const metricname[NMETRICS] = {
+    "simulated time", "messages sent from layer5", "dropped due to full window", "new ACKs received at A",
+    "packet resends by A", "correct packets received at B", "messages delivered", "goodput (msgs/time)",
+    "dropped at the bottleneck", "congestion window decreases", "mean congestion window",
+    "packet resends on a NAK", "mean NAK recovery time"};
+
+static void measure(double *m) {
+    double max;
+
+    m[M_TIME] = time;
+    m[M_SENT] = nsim;
+    m[M_FULL] = window_full;
+    m[M_NEWACKS] = new_ACKs;
+    m[M_RESENT] = packets_resent;
+    m[M_RECEIVED] = packets_received;
+    m[M_DELIVERED] = messages_delivered;
+    m[M_GOODPUT] = time > 0 ? messages_delivered / time : 0.0;
+    m[M_BNDROPS] = bndrops;
+    m[M_CWNDCUTS] = cwnd_cuts;
+    m[M_CWND] = congestion ? allcwnd() : 0.0;
+    m[M_NAKRESENT] = nak_resends;
+    allnaks(&m[M_RECOVERY], &max);
+}
+
+/* metric k means something for the current configuration */
+static int metricused(int k) {
+    if (k == M_BNDROPS) return (bnrate > 0);
+    if (k == M_CWNDCUTS || k == M_CWND) return (congestion);
+    if (k == M_NAKRESENT || k == M_RECOVERY) return (naks);
+    return (1);
+}
+
+/* one line of the comparison table: a run, or the means of its replications */
+struct summary {
+    const char *name;
+    double m[NMETRICS];
+    int replicated;
+};
+
+static void summarize(struct summary *s, const char *name) {
+    s->name = name;
+    s->replicated = 0;
+    measure(s->m);
+}
+
+static void printsummary(const struct summary *s, int n) {
+    const double *m;
+    int i, p;
+
+    printf("\n===== comparison: same arrivals, same loss/delay/corruption per packet =====\n");
+    printf("%-10s %10s %11s %8s %9s %12s %10s %10s %9s\n", "protocol", "delivered", "window_full", "resent",
+           "new_ACKs", "sim time", "goodput", "resent/msg", "mean cwnd");
+    for (i = 0; i < n; i++) {
+        m = s[i].m;
+        p = s[i].replicated ? 1 : 0; /* means get a decimal */
+        printf("%-10s %10.*f %11.*f %8.*f %9.*f %12.2f %10.4f %10.4f", s[i].name, p, m[M_DELIVERED], p, m[M_FULL], p,
+               m[M_RESENT], p, m[M_NEWACKS], m[M_TIME], m[M_GOODPUT],
+               m[M_DELIVERED] > 0 ? m[M_RESENT] / m[M_DELIVERED] : 0.0);
+        if (m[M_CWND] > 0) printf(" %9.2f\n", m[M_CWND]);
+        else
+            printf(" %9s\n", "fixed");
+    }
+}
+
+/* set up a run of the current protocol with the current seed */
+static void startrun(void) {
+    int f;
+
+    initrun();
+    for (f = 0; f < nflows; f++) {
+        selectflow(f);
+        proto->A_init();
+        proto->B_init();
+    }
+}
+
+/***************************** REPLICATIONS *****************************/
+/* Independent replications: run j uses seed + j, so replication 0 is the
+   ordinary run.  Each runs in a child process, up to jobs at a time, and
+   the parent takes the results in replication order, so the estimates and
+   the point where early stopping triggers do not depend on jobs or timing.
+   Intervals are mean +/- t(n-1) s / sqrt(n), at 95%.  With width > 0 the
+   replications stop, after at least REPMIN, once the goodput's interval is
+   within width times its mean; the other metrics, counts such as
+   window_full or the NAKs in particular, can stay far noisier and would
+   rarely let a run stop. */
+#define REPMIN 5
+
+/* two sided 95% quantile of Student's t with df degrees of freedom: from
+   the table up to 30, beyond that interpolated in 1/df, which t is close
+   to linear in, between 30, 40, 60, 120 and infinity (1.960) */
+static double t95(int df) {
+    static const double t[30] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                 2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                 2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    static const int tdf[] = {30, 40, 60, 120};
+    static const double tt[] = {2.042, 2.021, 2.000, 1.980};
+    int i;
+
+    if (df <= 30) return (t[df - 1]);
+    for (i = 1; i < 4; i++)
+        if (df <= tdf[i])
+            return (tt[i] + (tt[i - 1] - tt[i]) * (1.0 / df - 1.0 / tdf[i]) / (1.0 / tdf[i - 1] - 1.0 / tdf[i]));
+    return (1.960 + (1.980 - 1.960) * 120.0 / df);
+}
+
+/* start replication j in a child, which writes its metrics to *fd */
+static pid_t spawnreplication(unsigned int seed0, int j, int *fd) {
+    double m[NMETRICS];
+    int p[2];
+    pid_t pid;
+
+    if (pipe(p) != 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    if ((pid = fork()) < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(p[0]);
+        seed = seed0 + j;
+        TRACE = 0; /* replications run side by side */
+        startrun();
+        simulate(NULL, 1, FLT_MAX);
+        measure(m);
+        if (write(p[1], m, sizeof(m)) != sizeof(m)) _exit(EXIT_FAILURE);
+        _exit(messages_delivered == nsim - window_full ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(p[1]);
+    *fd = p[0];
+    return (pid);
+}
+
+/* run up to maxreps replications of the current protocol and print the
+   intervals; s gets the means.  0 if every replication passed the delivery
+   check. */
+static int replicate(int maxreps, double width, int jobs, struct summary *s) {
+    double mean[NMETRICS], m2[NMETRICS], m[NMETRICS], d, hw;
+    unsigned int seed0 = seed;
+    pid_t *pid;
+    int *fd;
+    int next, done, k, status, failed, stop;
+
+    pid = malloc(maxreps * sizeof(pid_t));
+    fd = malloc(maxreps * sizeof(int));
+    if (pid == 0 || fd == 0) {
+        printf("memory allocation for replications failed.");
+        exit(EXIT_FAILURE);
+    }
+    for (k = 0; k < NMETRICS; k++) mean[k] = m2[k] = 0.0;
+    failed = stop = 0;
+    for (next = done = 0; done < maxreps && !stop; done++) {
+        while (next < maxreps && next - done < jobs) {
+            pid[next] = spawnreplication(seed0, next, &fd[next]);
+            next++;
+        }
+        if (read(fd[done], m, sizeof(m)) != sizeof(m)) failed = 1;
+        close(fd[done]);
+        if (waitpid(pid[done], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+        if (failed) {
+            printf("replication %d (seed %u) failed\n", done, seed0 + done);
+            stop = 1;
+            continue;
+        }
+        /* Welford's running mean and sum of squared deviations */
+        for (k = 0; k < NMETRICS; k++) {
+            d = m[k] - mean[k];
+            mean[k] += d / (done + 1);
+            m2[k] += d * (m[k] - mean[k]);
+        }
+        if (width > 0 && done + 1 >= REPMIN)
+            stop = t95(done) * sqrt(m2[M_GOODPUT] / done / (done + 1)) <= width * fabs(mean[M_GOODPUT]);
+    }
+    for (k = done; k < next; k++) { /* replications no longer needed */
+        kill(pid[k], SIGKILL);
+        close(fd[k]);
+        waitpid(pid[k], &status, 0);
+    }
+    seed = seed0;
+    free(pid);
+    free(fd);
+    if (failed) return (-1);
+
+    printf("%d replication(s), seeds %u to %u", done, seed0, seed0 + done - 1);
+    if (width > 0 && stop) printf(", stopped early: goodput's interval within %g%% of its mean", 100 * width);
+    else if (width > 0)
+        printf(", goodput's interval not within %g%% of its mean", 100 * width);
+    printf("\n%-32s %14s %14s %8s\n", "metric", "mean", "95% CI +/-", "rel");
+    for (k = 0; k < NMETRICS; k++) {
+        if (!metricused(k)) continue;
+        hw = done > 1 ? t95(done - 1) * sqrt(m2[k] / (done - 1) / done) : 0.0;
+        printf("%-32s %14.4f %14.4f %7.2f%%\n", metricname[k], mean[k], hw,
+               mean[k] != 0 ? 100 * hw / fabs(mean[k]) : 0.0);
+    }
+    for (k = 0; k < NMETRICS; k++) s->m[k] = mean[k];
+    s->replicated = 1;
+    return (0);
+}
+
+/******************************** TUNING ********************************/
+/* -T budget searches A's window and timeout for the current protocol,
+   under the channel and workload given on stdin, for the highest goodput
+   whose retransmission overhead (packets resent per message delivered) is
+   at most budget.  A candidate, a window and a timeout, is run with seeds
+   seed ... seed + reps - 1 and judged on the means.  Every candidate gets
+   the same seeds, so candidates differ by their settings rather than
+   their luck.  The search:
+   - a coarse grid: windows 1, 2, 4, ... and the engine's largest, timeouts
+     TUNERTTMIN, 2 TUNERTTMIN, ... TUNERTTMAX
+   - every window between the best grid point's neighbours, at its timeout
+   - golden-section search on the timeout between the grid timeouts either
+     side of the best, at the best window so far
+   Each batch of candidates has its runs spread over jobs processes. */
+#define TUNERTTMIN 4.0
+#define TUNERTTMAX 256.0
+#define TUNEREPS 4      /* seeds per candidate unless -R is given */
+#define TUNESTEPS 10    /* golden-section steps, the interval shrinks to 0.618^10 (< 1%) */
+#define MAXCANDIDATES 128
+#define GOLDEN 0.6180339887
+
+struct candidate {
+    int window;
+    double rtt;
+    double m[NMETRICS]; /* means over the seeds */
+};
+
+/* packets resent per message delivered */
+static double overhead(const struct candidate *c) {
+    if (c->m[M_DELIVERED] > 0) return (c->m[M_RESENT] / c->m[M_DELIVERED]);
+    return (c->m[M_RESENT] > 0 ? HUGE_VAL : 0.0);
+}
+
+/* a beats b: within the budget beats over it, then the higher goodput
+   wins or, both over it, the lower overhead */
+static int better(const struct candidate *a, const struct candidate *b, double budget) {
+    int ina = overhead(a) <= budget, inb = overhead(b) <= budget;
+
+    if (ina != inb) return (ina);
+    if (ina) return (a->m[M_GOODPUT] > b->m[M_GOODPUT]);
+    return (overhead(a) < overhead(b));
+}
+
+/* run candidates c[0..n-1] with reps seeds each, a process per run and up
+   to jobs at once, and fill in their means; 0 if every run passed the
+   delivery check */
+static int evaluate(struct candidate *c, int n, int reps, int jobs) {
+    double m[NMETRICS];
+    pid_t *pid, done;
+    int *fd;
+    int p[2];
+    int next, running, k, j, status, failed;
+
+    pid = malloc(n * reps * sizeof(pid_t));
+    fd = malloc(n * reps * sizeof(int));
+    if (pid == 0 || fd == 0) {
+        printf("memory allocation for tuning failed.");
+        exit(EXIT_FAILURE);
+    }
+    for (k = 0; k < n; k++)
+        for (j = 0; j < NMETRICS; j++) c[k].m[j] = 0.0;
+    fflush(stdout);
+    failed = 0;
+    for (next = running = 0; (next < n * reps && !failed) || running > 0;) {
+        if (next < n * reps && !failed && running < jobs) { /* start run next */
+            if (pipe(p) != 0) {
+                perror("pipe");
+                exit(EXIT_FAILURE);
+            }
+            if ((pid[next] = fork()) < 0) {
+                perror("fork");
+                exit(EXIT_FAILURE);
+            }
+            if (pid[next] == 0) {
+                close(p[0]);
+                TRACE = 0; /* runs side by side */
+                seed += next % reps;
+                sendwindow = c[next / reps].window;
+                sendrtt = c[next / reps].rtt;
+                startrun();
+                simulate(NULL, 1, FLT_MAX);
+                measure(m);
+                if (write(p[1], m, sizeof(m)) != sizeof(m) || messages_delivered != nsim - window_full)
+                    _exit(EXIT_FAILURE);
+                _exit(EXIT_SUCCESS);
+            }
+            close(p[1]);
+            fd[next++] = p[0];
+            running++;
+            continue;
+        }
+        /* take whichever run finishes first, so a slow one holds up no other */
+        if ((done = wait(&status)) < 0) {
+            perror("wait");
+            exit(EXIT_FAILURE);
+        }
+        for (k = 0; k < next && pid[k] != done; k++) continue;
+        if (k == next) continue;
+        running--;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || read(fd[k], m, sizeof(m)) != sizeof(m)) failed = 1;
+        for (j = 0; j < NMETRICS && !failed; j++) c[k / reps].m[j] += m[j] / reps;
+        close(fd[k]);
+    }
+    free(pid);
+    free(fd);
+    return (failed ? -1 : 0);
+}
+
+/* tune the current protocol, called name on -p, and print the recommended
+   settings; 0 if every run passed the delivery check */
+static int tune(const char *name, double budget, int reps, int jobs) {
+    struct candidate c[MAXCANDIDATES], g[2], best;
+    int windows[MAXCANDIDATES];
+    double rtts[MAXCANDIDATES], a, b;
+    int nwindows, nrtts, n, bi, bj, i, j, lo, hi, step;
+
+    for (nwindows = 0; (1 << nwindows) < proto->maxwindow; nwindows++) windows[nwindows] = 1 << nwindows;
+    windows[nwindows++] = proto->maxwindow;
+    for (nrtts = 0; TUNERTTMIN * (1 << nrtts) <= TUNERTTMAX; nrtts++) rtts[nrtts] = TUNERTTMIN * (1 << nrtts);
+    if (nwindows * nrtts > MAXCANDIDATES) nwindows = MAXCANDIDATES / nrtts;
+
+    printf("tuning %s: highest goodput with at most %g resends per delivered message, %d seed(s) from %u\n",
+           name, budget, reps, seed);
+    for (i = n = 0; i < nwindows; i++)
+        for (j = 0; j < nrtts; j++, n++) {
+            c[n].window = windows[i];
+            c[n].rtt = rtts[j];
+        }
+    if (evaluate(c, n, reps, jobs) != 0) return (-1);
+    printf("goodput on the grid, * over the budget\n%6s %3s", "window", "RTT");
+    for (j = 0; j < nrtts; j++) printf(" %9g", rtts[j]);
+    printf("\n");
+    for (i = bi = bj = 0; i < nwindows; i++) {
+        printf("%10d", windows[i]);
+        for (j = 0; j < nrtts; j++) {
+            printf(" %8.4f%c", c[i * nrtts + j].m[M_GOODPUT], overhead(&c[i * nrtts + j]) > budget ? '*' : ' ');
+            if (better(&c[i * nrtts + j], &c[bi * nrtts + bj], budget)) {
+                bi = i;
+                bj = j;
+            }
+        }
+        printf("\n");
+    }
+    best = c[bi * nrtts + bj];
+
+    /* every window between the grid neighbours of the best */
+    lo = bi > 0 ? windows[bi - 1] : windows[0];
+    hi = bi < nwindows - 1 ? windows[bi + 1] : windows[bi];
+    step = (hi - lo + MAXCANDIDATES - 1) / MAXCANDIDATES;
+    for (i = lo + 1, n = 0; i < hi; i += step)
+        if (i != best.window) {
+            c[n].window = i;
+            c[n++].rtt = best.rtt;
+        }
+    if (n > 0) {
+        printf("refining: windows %d to %d at RTT %g", lo + 1, hi - 1, best.rtt);
+        if (evaluate(c, n, reps, jobs) != 0) return (-1);
+        for (i = 0; i < n; i++)
+            if (better(&c[i], &best, budget)) best = c[i];
+    } else
+        printf("refining:");
+
+    /* golden-section search on the timeout */
+    a = bj > 0 ? rtts[bj - 1] : rtts[0];
+    b = bj < nrtts - 1 ? rtts[bj + 1] : rtts[bj];
+    printf("%s RTT %g to %g at window %d\n", n > 0 ? "," : "", a, b, best.window);
+    g[0].window = g[1].window = best.window;
+    g[0].rtt = b - GOLDEN * (b - a);
+    g[1].rtt = a + GOLDEN * (b - a);
+    if (evaluate(g, 2, reps, jobs) != 0) return (-1);
+    for (i = 0; i < TUNESTEPS; i++) {
+        if (better(&g[0], &g[1], budget)) { /* the best is in [a, g[1]] */
+            b = g[1].rtt;
+            g[1] = g[0];
+            g[0].rtt = b - GOLDEN * (b - a);
+            j = 0;
+        } else {
+            a = g[0].rtt;
+            g[0] = g[1];
+            g[1].rtt = a + GOLDEN * (b - a);
+            j = 1;
+        }
+        if (evaluate(&g[j], 1, reps, jobs) != 0) return (-1);
+    }
+    for (j = 0; j < 2; j++)
+        if (better(&g[j], &best, budget)) best = g[j];
+
+    if (overhead(&best) <= budget) printf("recommended for %s:", name);
+    else
+        printf("no setting found within the budget; the lowest overhead for %s:", name);
+    if (proto->maxwindow > 1) printf(" WINDOWSIZE %d,", best.window);
+    printf(" RTT %.2f\n", best.rtt);
+    printf("  goodput %.4f, %.4f resends per delivered message, %.1f of %.1f messages delivered in %.2f time\n"
+           "  units (means over the seeds)\n",
+           best.m[M_GOODPUT], overhead(&best), best.m[M_DELIVERED], best.m[M_SENT], best.m[M_TIME]);
+    return (0);
+}
+
+/****************************** PARTITIONS ******************************/
+/* A partitioned run (-P n) spreads the flows over n worker processes, flow
+   f going to worker f % n, and keeps the bottleneck in the parent, the link
+   process.  Flows only meet at the bottleneck and a packet arrives at least
+   LOOKAHEAD after it is sent, so the run proceeds in windows: with T the
+   time of the earliest pending event anywhere, every worker handles its
+   events before T + LOOKAHEAD on its own and sends the A->B packets its
+   flows sent meanwhile to the link process.  That sorts them on (time sent,
+   flow, packet of the flow), queues or drops them at the bottleneck and
+   hands the arrivals, none before T + LOOKAHEAD, to the workers for the next
+   window.  The ordinary run of several flows keeps the same link order:
+   simulate() hands the packets sent at one time to the link, linkflush(),
+   once time moves on.  As every flow draws from its own random streams and
+   the link order does not depend on n, a run gives the same results for
+   any n, -P 0 included.  Without a bottleneck the flows never meet and the
+   workers run to the end in one window.  With TRACE > 0 the trace lines of
+   different workers interleave. */
+#define LOOKAHEAD 1.0 /* the channel's minimum delay, see arrivaltime() */
+
+/* an A->B packet on its way to the link process and back */
+struct linkpkt {
+    float t;        /* when A sent it; on the way back, when it arrives at B */
+    int flow;
+    long n;         /* the flow's A->B packets handed to the link before it */
+    double delay;   /* its delay draw */
+    struct pkt pkt; /* as sent, possibly corrupted */
+};
+static struct linkpkt *linkq; /* a worker's packets of this window, or the link's */
+static int linkqsize;
+
+/* what precedes a window's packets: from the link process, the end of the
+   window (-1: stop); from a worker, the time of its next event (-1: none) */
+struct window {
+    float t;
+    int npkts;
+};
+
+/* counters every worker adds to */
+static int *const partcounts[] = {&window_full, &cwnd_cuts,          &total_ACKs_received, &packets_resent,
+                                  &new_ACKs,    &packets_received,   &messages_delivered,  &nsim,
+                                  &ntolayer3,   &nlost,              &ncorrupt,            &nak_resends};
+#define NPARTCOUNTS (sizeof(partcounts) / sizeof(partcounts[0]))
+
+static struct linkpkt *linkslot(void) {
+    if (nlinkq == linkqsize) {
+        linkqsize = linkqsize == 0 ? 64 : 2 * linkqsize;
+        linkq = realloc(linkq, linkqsize * sizeof(struct linkpkt));
+        if (linkq == 0) {
+            printf("memory allocation for the link queue failed.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return (&linkq[nlinkq++]);
+}
+
+/* hand the A->B packet of evptr, sent now, to the link process */
+static void linkqueue(const struct event *evptr, double delay) {
+    struct linkpkt *lp = linkslot();
+
+    lp->t = time;
+    lp->flow = evptr->flow;
+    lp->n = cur->linked++;
+    lp->delay = delay;
+    lp->pkt = *evptr->pktptr;
+}
+
+/* schedule the arrival at B of a packet the link let through */
+static void linkarrival(const struct linkpkt *lp) {
+    struct event *evptr;
+
+    evptr = malloc(sizeof(struct event));
+    if (evptr == 0 || (evptr->pktptr = malloc(sizeof(struct pkt))) == 0) {
+        printf("memory allocation for event failed.");
+        exit(EXIT_FAILURE);
+    }
+    *evptr->pktptr = lp->pkt;
+    evptr->evtime = lp->t;
+    evptr->evtype = FROM_LAYER3;
+    evptr->eventity = B;
+    evptr->flow = lp->flow;
+    inflight[B]++;
+    insertevent(evptr);
+}
+
+static int linkorder(const void *a, const void *b) {
+    const struct linkpkt *p = a, *q = b;
+
+    if (p->t != q->t) return (p->t < q->t ? -1 : 1);
+    if (p->flow != q->flow) return (p->flow < q->flow ? -1 : 1);
+    return (p->n < q->n ? -1 : p->n > q->n);
+}
+
+/* worker w: keep the events of its flows, simulate windows until told to
+   stop, then send back its counters and flows */
+static void partworker(int w, FILE *in, FILE *out) {
+    struct window win;
+    struct linkpkt lp;
+    struct event *evptr;
+    int counts[NPARTCOUNTS];
+    int i, n;
+
+    n = nevlist; /* drop the other workers' events, sifting ours into place */
+    for (i = nevlist = 0; i < n; i++) {
+        evptr = evheap[i];
+        if (evptr->flow % nparts != w) {
+            free(evptr);
+            continue;
+        }
+        evplace(evptr, nevlist++);
+        evsift(evptr->heappos, SCAN_INSERT);
+    }
+
+    while (fread(&win, sizeof(win), 1, in) == 1 && win.t >= 0) {
+        for (i = 0; i < win.npkts; i++) { /* the arrivals the link process scheduled */
+            if (fread(&lp, sizeof(lp), 1, in) != 1) _exit(EXIT_FAILURE);
+            linkarrival(&lp);
+        }
+        simulate(NULL, 1, win.t);
+        win.t = nevlist > 0 ? evheap[0]->evtime : -1;
+        win.npkts = nlinkq;
+        fwrite(&win, sizeof(win), 1, out);
+        fwrite(linkq, sizeof(struct linkpkt), nlinkq, out);
+        nlinkq = 0;
+        fflush(stdout);
+        if (fflush(out) != 0) _exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < (int)NPARTCOUNTS; i++) counts[i] = *partcounts[i];
+    fwrite(counts, sizeof(counts), 1, out);
+    fwrite(&nevents, sizeof(nevents), 1, out);
+    fwrite(&time, sizeof(time), 1, out);
+    for (i = w; i < nflows; i += nparts) fwrite(&flows[i], sizeof(struct flow), 1, out);
+    fflush(stdout);
+    _exit(fflush(out) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/* the link process's part of a window: queue or drop the packets the
+   workers sent in it, in link order, and keep the arrivals; returns the
+   earliest arrival, or next if that is earlier (-1: none) */
+static float linkwindow(float next) {
+    float lastime;
+    int i, n;
+
+    qsort(linkq, nlinkq, sizeof(struct linkpkt), linkorder);
+    for (i = n = 0; i < nlinkq; i++) {
+        time = linkq[i].t;
+        selectflow(linkq[i].flow);
+        lastime = time;
+        if (!bottleneck(&lastime)) continue;
+        linkq[i].t = arrivaltime(B, lastime, linkq[i].delay);
+        if (next < 0 || linkq[i].t < next) next = linkq[i].t;
+        linkq[n++] = linkq[i];
+    }
+    nlinkq = n;
+    return (next);
+}
+
+/* the ordinary run's link: the packets the flows sent at this time, all
+   of them, go through the bottleneck as the link process would take them */
+static void linkflush(void) {
+    int i;
+
+    linkwindow(-1);
+    for (i = 0; i < nlinkq; i++) linkarrival(&linkq[i]);
+    nlinkq = 0;
+}
+
+/* a partitioned run of the current protocol with the current seed; leaves
+   the counters and flows as the ordinary run would for report().  0 if
+   every worker finished. */
+static int runpartitioned(void) {
+    struct window win;
+    struct event *evptr;
+    FILE **in, **out;
+    pid_t *pid;
+    int counts[NPARTCOUNTS];
+    long n;
+    float t, next;
+    int down[2], up[2];
+    int w, i, status, failed;
+
+    in = malloc(nparts * sizeof(FILE *));
+    out = malloc(nparts * sizeof(FILE *));
+    pid = malloc(nparts * sizeof(pid_t));
+    if (in == 0 || out == 0 || pid == 0) {
+        printf("memory allocation for partitions failed.");
+        exit(EXIT_FAILURE);
+    }
+    startrun();
+    signal(SIGPIPE, SIG_IGN); /* a worker that fails shows as a short read */
+    fflush(stdout);
+    for (w = 0; w < nparts; w++) {
+        if (pipe(down) != 0 || pipe(up) != 0) {
+            perror("pipe");
+            exit(EXIT_FAILURE);
+        }
+        if ((pid[w] = fork()) < 0) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+        if (pid[w] == 0) {
+            for (i = 0; i < w; i++) { /* so the parent sees EOF if a worker dies */
+                close(fileno(in[i]));
+                close(fileno(out[i]));
+            }
+            close(down[1]);
+            close(up[0]);
+            partworker(w, fdopen(down[0], "r"), fdopen(up[1], "w"));
+        }
+        close(down[0]);
+        close(up[1]);
+        in[w] = fdopen(up[0], "r");
+        out[w] = fdopen(down[1], "w");
+        if (in[w] == NULL || out[w] == NULL) {
+            perror("fdopen");
+            exit(EXIT_FAILURE);
+        }
+    }
+    next = nevlist > 0 ? evheap[0]->evtime : -1;
+    while ((evptr = nextevent()) != NULL) free(evptr); /* the workers have them */
+
+    failed = 0;
+    while (!failed) {
+        next = linkwindow(next);
+        win.t = next < 0 ? -1 : bnrate > 0 ? next + LOOKAHEAD : FLT_MAX;
+        for (w = 0; w < nparts; w++) {
+            for (i = win.npkts = 0; i < nlinkq; i++) win.npkts += linkq[i].flow % nparts == w;
+            fwrite(&win, sizeof(win), 1, out[w]);
+            for (i = 0; i < nlinkq; i++)
+                if (linkq[i].flow % nparts == w) fwrite(&linkq[i], sizeof(struct linkpkt), 1, out[w]);
+            if (fflush(out[w]) != 0) failed = 1;
+        }
+        if (next < 0) break;
+        nlinkq = 0;
+        next = -1;
+        for (w = 0; w < nparts && !failed; w++) {
+            if (fread(&win, sizeof(win), 1, in[w]) != 1) failed = 1;
+            else if (win.t >= 0 && (next < 0 || win.t < next))
+                next = win.t;
+            for (i = 0; i < win.npkts && !failed; i++)
+                if (fread(linkslot(), sizeof(struct linkpkt), 1, in[w]) != 1) failed = 1;
+        }
+    }
+
+    /* the run's counters are the workers' sums, it ended with the last event */
+    for (i = 0; i < (int)NPARTCOUNTS; i++) *partcounts[i] = 0;
+    nevents = 0;
+    time = 0.0;
+    for (w = 0; w < nparts && !failed; w++) {
+        if (fread(counts, sizeof(counts), 1, in[w]) != 1 || fread(&n, sizeof(n), 1, in[w]) != 1 ||
+            fread(&t, sizeof(t), 1, in[w]) != 1) {
+            failed = 1;
+            break;
+        }
+        for (i = 0; i < (int)NPARTCOUNTS; i++) *partcounts[i] += counts[i];
+        nevents += n;
+        if (t > time) time = t;
+        for (i = w; i < nflows; i += nparts) {
+            if (fread(&flows[i], sizeof(struct flow), 1, in[w]) != 1) failed = 1;
+            flows[i].timer[A] = flows[i].timer[B] = NULL;
+        }
+    }
+    for (w = 0; w < nparts; w++) {
+        if (failed) kill(pid[w], SIGKILL);
+        fclose(in[w]);
+        fclose(out[w]);
+        if (waitpid(pid[w], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) failed = 1;
+    }
+    signal(SIGPIPE, SIG_DFL);
+    nlinkq = 0;
+    free(in);
+    free(out);
+    free(pid);
+    return (failed ? -1 : 0);
+}
+
+/******************************* LIBRARY ********************************/
+/* run_simulation() (simulation.h) sets what rdt reads from stdin and its
+   options from a struct simconfig, then runs as rdt does: initrun() resets
+   every counter and the flows, and the event list is emptied after the
+   run, so nothing carries over to the next. */
+
+void simdefaults(struct simconfig *cfg) {
+    cfg->protocol = "gbn";
+    cfg->nmsgs = 1000;
+    cfg->loss = 0.0;
+    cfg->corrupt = 0.0;
+    cfg->direction = 2;
+    cfg->lambda = 10.0;
+    cfg->trace = 0;
+    cfg->seed = 9999;
+    cfg->flows = 1;
+    cfg->bnrate = 0.0;
+    cfg->bnqueue = 64;
+    cfg->until = 0.0;
+    cfg->window = 0;
+    cfg->rtt = 0.0;
+}
+
+/* free the events a run stopped at until left behind */
+static void clearevents(void) {
+    struct event *evptr;
+    int f;
+
+    while ((evptr = nextevent()) != NULL) {
+        if (evptr->evtype == FROM_LAYER3) free(evptr->pktptr);
+        free(evptr);
+    }
+    for (f = 0; f < nflows; f++) flows[f].timer[A] = flows[f].timer[B] = NULL;
+}
+
+int run_simulation(const struct simconfig *cfg, struct simresults *results) {
+    const struct protocol *p;
+    int options;
+
+    p = selectprotocol(cfg->protocol, &options);
+    if (p == NULL || cfg->nmsgs < 0 || cfg->loss < 0 || cfg->loss > 1 || cfg->corrupt < 0 || cfg->corrupt > 1 ||
+        cfg->direction < 0 || cfg->direction > 2 || cfg->lambda <= 0 || cfg->flows < 1 || cfg->bnrate < 0 ||
+        cfg->bnqueue < 0 || cfg->until < 0 || cfg->window < 0 || cfg->rtt < 0)
+        return (-1);
+    proto = p;
+    congestion = (options & OPT_AIMD) != 0;
+    naks = (options & OPT_NAK) != 0;
+    nsimmax = cfg->nmsgs;
+    lossprob = cfg->loss;
+    corruptprob = cfg->corrupt;
+    corruptdirection = cfg->direction;
+    lambda = cfg->lambda;
+    TRACE = cfg->trace;
+    seed = cfg->seed;
+    nflows = cfg->flows;
+    bnrate = cfg->bnrate;
+    bnqueue = cfg->bnqueue;
+    sendwindow = cfg->window;
+    sendrtt = cfg->rtt;
+    splitstreams = 0;
+    nparts = 0;
+
+    embedded = 1;
+    runfailed = 0;
+    startrun();
+    simulate(NULL, 1, cfg->until > 0 ? cfg->until : FLT_MAX);
+    results->finished = nevlist == 0 && !runfailed;
+    clearevents();
+    embedded = 0;
+
+    results->time = time;
+    results->events = nevents;
+    results->sent = nsim;
+    results->window_full = window_full;
+    results->new_ACKs = new_ACKs;
+    results->resent = packets_resent;
+    results->received = packets_received;
+    results->delivered = messages_delivered;
+    results->goodput = time > 0 ? messages_delivered / time : 0.0;
+    results->lost = nlost;
+    results->corrupted = ncorrupt;
+    results->bndrops = bndrops;
+    results->cwnd_cuts = cwnd_cuts;
+    results->cwnd = congestion ? allcwnd() : 0.0;
+    results->naks = allnaks(&results->recovery, &results->recoverymax);
+    results->nak_resends = nak_resends;
+    results->ok = !runfailed && (!results->finished || messages_delivered == nsim - window_full);
+    return (0);
+}
+
+#define MAXRUNS 8 /* protocols on one -p list */
+
+int main(int argc, char *argv[]) {
+    char names[256];
+    const struct protocol *run[MAXRUNS];
+    const char *runname[MAXRUNS];
+    int runopts[MAXRUNS]; /* OPT_ bits from the run's name */
+    struct summary results[MAXRUNS];
+    const char *protolist = DEFAULT_PROTOCOL;
+    const char *ckptfile = NULL;   /* write checkpoints here */
+    const char *resumefile = NULL; /* resume from here */
+    const char *samplefile = NULL; /* time series from -s */
+    long ckptevery = 1000000;      /* events between checkpoints */
+    int reps = 0;                  /* replications per protocol (tuning: seeds per candidate) */
+    double budget = -1;            /* tune for at most budget resends per message, < 0: no tuning */
+    double width = 0.0;            /* early stopping relative interval width */
+    int jobs;                      /* replications run in parallel */
+    char *name;
+    int nrun, failed;
+
+    int i;
+
+    jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) ckptfile = argv[++i];
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            ckptevery = atol(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            resumefile = argv[++i];
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+            protolist = argv[++i];
+        else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            nflows = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+            bnrate = atof(argv[++i]);
+        else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+            bnqueue = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc)
+            reps = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+            width = atof(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+            jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc)
+            nparts = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            sampleevery = atof(argv[++i]);
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            samplefile = argv[++i];
+        else if (strcmp(argv[i], "-W") == 0 && i + 1 < argc)
+            sendwindow = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            sendrtt = atof(argv[++i]);
+        else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc)
+            budget = atof(argv[++i]);
+        else
+            usage(argv[0]);
+    }
+    if (jobs < 1) jobs = 1;
+    if (reps == 0) reps = budget >= 0 ? TUNEREPS : 1;
+    if (ckptevery <= 0 || strlen(protolist) >= sizeof(names) || nflows < 1 || bnrate < 0 || bnqueue < 0 ||
+        reps < 1 || width < 0 || sampleevery < 0 || (sampleevery > 0) != (samplefile != NULL) ||
+        (samplefile != NULL && reps > 1) || nparts < 0 ||
+        (nparts > 0 && (reps > 1 || samplefile != NULL || ckptfile != NULL || resumefile != NULL)) ||
+        sendwindow < 0 || sendrtt < 0 ||
+        (budget >= 0 && (nparts > 0 || samplefile != NULL || ckptfile != NULL || resumefile != NULL ||
+                         sendwindow > 0 || sendrtt > 0)))
+        usage(argv[0]);
+    if (nparts > nflows) nparts = nflows;
+    if (nflows == 1) nparts = 0; /* nothing to spread */
+
+    strcpy(names, protolist);
+    for (nrun = 0, name = strtok(names, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (nrun == MAXRUNS) usage(argv[0]);
+        runname[nrun] = name;
+        run[nrun] = selectprotocol(name, &runopts[nrun]);
+        if (run[nrun] == NULL) {
+            printf("unknown protocol or option %s\n", name);
+            usage(argv[0]);
+        }
+        nrun++;
+    }
+    if (nrun == 0 || ((nrun > 1 || reps > 1) && (ckptfile != NULL || resumefile != NULL))) usage(argv[0]);
+
+    if (resumefile != NULL) {
+        if (readcheckpoint(resumefile) != 0) {
+            printf("unable to resume from checkpoint %s\n", resumefile);
+            return EXIT_FAILURE;
+        }
+        if (samplefile != NULL) opensamples(samplefile, 1);
+        samplerun = ckptrun;
+        simulate(ckptfile, ckptevery, FLT_MAX);
+        closesamples();
+        return (report() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    init();
+    if (samplefile != NULL) opensamples(samplefile, 0);
+    splitstreams = nrun > 1;
+    failed = 0;
+    for (i = 0; i < nrun; i++) {
+        proto = run[i];
+        congestion = (runopts[i] & OPT_AIMD) != 0;
+        naks = (runopts[i] & OPT_NAK) != 0;
+        if (nrun > 1) printf("\n===== %s =====\n", runname[i]);
+        if (budget >= 0) {
+            if (tune(runname[i], budget, reps, jobs) != 0) {
+                printf("tuning %s failed\n", runname[i]);
+                failed = 1;
+            }
+            continue;
+        }
+        if (reps > 1) {
+            if (replicate(reps, width, jobs, &results[i]) != 0) failed = 1;
+            results[i].name = runname[i];
+            continue;
+        }
+        if (nparts > 0) {
+            if (runpartitioned() != 0) {
+                printf("partitioned run of %s failed\n", runname[i]);
+                return EXIT_FAILURE;
+            }
+        } else {
+            startrun();
+            samplerun = runname[i];
+            simulate(ckptfile, ckptevery, FLT_MAX);
+        }
+        if (report() != 0) failed = 1;
+        summarize(&results[i], runname[i]);
+    }
+    closesamples();
+    if (nrun > 1 && budget < 0) printsummary(results, nrun);
+    return (failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
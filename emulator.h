@@ -6,6 +6,8 @@ extern int packets_resent;       /* count of the number of packets resent  */
 extern int new_ACKs;      /* count of the number of acks correctly received */
 extern int packets_received;  /* count of the packets received by receiver */
 extern int window_full; /* count of the number of messages dropped due to full window */
+extern int cwnd_cuts;   /* count of the multiplicative decreases of the congestion window */
+extern int nak_resends; /* count of the packets resent because B sent a NAK for them */
 
 #define   A    0
 #define   B    1
@@ -27,14 +29,17 @@ struct pkt {
   char payload[20];
 };
 
-/* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);  
+/* send to A or B (int), packet to send (copied, the caller keeps ownership) */
+extern void tolayer3(int, const struct pkt *);
 
 /* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
+extern void tolayer5(int, const char[20]);
 
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern void stoptimer(int);
+
+/* congestion window of A or B (int) is now double packets, for the statistics */
+extern void setcwnd(int, double);               
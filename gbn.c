@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include "emulator.h"
+#include "protocol.h"
 #include "gbn.h"
 
 /* ******************************************************************
@@ -23,73 +24,72 @@
 **********************************************************************/
 
 #define RTT 16.0 /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#ifdef GBN_WINDOWSIZE /* the tuner (make tune) builds larger windows */
+#define WINDOWSIZE GBN_WINDOWSIZE
+#define SEQSPACE (WINDOWSIZE + 1)
+#else
 #define WINDOWSIZE                                                                                 \
     6                 /* the maximum number of buffered unacked packet                             \
                         MUST BE SET TO 6 when submitting assignment */
 #define SEQSPACE 7    /* the min sequence space for GBN must be at least windowsize + 1 */
+#endif
 #define NOTINUSE (-1) /* used to fill header fields that are not being used */
 
-/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
-   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
-   original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
-*/
-int ComputeChecksum(struct pkt packet) {
-    int checksum = 0;
-    int i;
+/* A and B state of one connection, the emulator keeps one per flow (see protocol.h) */
+struct flowstate {
+    /* sender (A) */
+    struct pkt buffer[WINDOWSIZE]; /* array for storing packets waiting for ACK */
+    int windowfirst, windowlast;   /* array indexes of the first/last packet awaiting ACK */
+    int windowcount;               /* the number of packets currently awaiting an ACK */
+    int windowsent;                /* of which sent since the last timeout, the first ones */
+    int A_nextseqnum;              /* the next sequence number to be used by the sender */
+    struct cwnd cc;                /* congestion window, when enabled */
 
-    checksum = packet.seqnum;
-    checksum += packet.acknum;
-    for (i = 0; i < 20; i++) checksum += (int)(packet.payload[i]);
+    /* receiver (B) */
+    int expectedseqnum; /* the sequence number expected next by the receiver */
+    int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+    bool naked;         /* a NAK for expectedseqnum has been sent */
+};
 
-    return checksum;
-}
+static struct flowstate *flow;
 
-bool IsCorrupted(struct pkt packet) {
-    if (packet.checksum == ComputeChecksum(packet)) return (false);
-    else
-        return (true);
-}
+static void setflow(void *state) { flow = state; }
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE]; /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;   /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;               /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;              /* the next sequence number to be used by the sender */
-
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message) {
+static void A_output(struct msg message) {
     struct pkt sendpkt;
     int i;
 
     /* if not blocked waiting on ACK */
-    if (windowcount < WINDOWSIZE) {
+    if (flow->windowcount < cwnd_window(&flow->cc)) {
         if (TRACE > 1)
             printf("----A: New message arrives, send window is not full, send new messge to "
                    "layer3!\n");
 
         /* create packet */
-        sendpkt.seqnum = A_nextseqnum;
+        sendpkt.seqnum = flow->A_nextseqnum;
         sendpkt.acknum = NOTINUSE;
         for (i = 0; i < 20; i++) sendpkt.payload[i] = message.data[i];
-        sendpkt.checksum = ComputeChecksum(sendpkt);
+        sendpkt.checksum = ComputeChecksum(&sendpkt);
 
         /* put packet in window buffer */
         /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-        windowlast = (windowlast + 1) % WINDOWSIZE;
-        buffer[windowlast] = sendpkt;
-        windowcount++;
+        flow->windowlast = (flow->windowlast + 1) % WINDOWSIZE;
+        flow->buffer[flow->windowlast] = sendpkt;
+        flow->windowcount++;
+        flow->windowsent++;
 
         /* send out packet */
         if (TRACE > 0) printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-        tolayer3(A, sendpkt);
+        tolayer3(A, &sendpkt);
 
         /* start timer if first packet in window */
-        if (windowcount == 1) starttimer(A, RTT);
+        if (flow->windowcount == 1) starttimer(A, SENDRTT(RTT));
 
         /* get next sequence number, wrap back to 0 */
-        A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+        flow->A_nextseqnum = (flow->A_nextseqnum + 1) % SEQSPACE;
     }
     /* if blocked,  window is full */
     else {
@@ -98,46 +98,110 @@ void A_output(struct msg message) {
     }
 }
 
+/* after a timeout the congestion window may hold back part of the window:
+   resend the packets not sent since, as far as the congestion window allows */
+static void resendpending(void) {
+    struct pkt *p;
+
+    while (flow->windowsent < flow->windowcount && flow->windowsent < cwnd_window(&flow->cc)) {
+        p = &flow->buffer[(flow->windowfirst + flow->windowsent) % WINDOWSIZE];
+        if (TRACE > 0) printf("---A: resending packet %d\n", p->seqnum);
+        tolayer3(A, p);
+        packets_resent++;
+        flow->windowsent++;
+    }
+}
+
+/* the first ackcount packets of the window are acknowledged */
+static void slidewindow(int ackcount) {
+    flow->windowfirst = (flow->windowfirst + ackcount) % WINDOWSIZE;
+    flow->windowcount -= ackcount;
+    flow->windowsent = flow->windowsent > ackcount ? flow->windowsent - ackcount : 0;
+    cwnd_ack(&flow->cc, ackcount);
+}
+
+/* B is missing packet seqnum (see NAK in protocol.h): everything before it
+   has arrived, so slide the window up to it and resend it alone.  A NAK
+   for A_nextseqnum acknowledges the whole window, with nothing to resend. */
+static void A_nak(int seqnum) {
+    int seqfirst, ackcount;
+
+    total_ACKs_received++;
+    ackcount = (seqnum - flow->buffer[flow->windowfirst].seqnum + SEQSPACE) % SEQSPACE;
+    if (flow->windowcount == 0 || seqnum < 0 || seqnum >= SEQSPACE || ackcount > flow->windowcount) {
+        if (TRACE > 0) printf("----A: NAK %d is not for a packet in the window, do nothing!\n", seqnum);
+        return;
+    }
+    if (ackcount == flow->windowcount) {
+        if (TRACE > 0) printf("----A: NAK %d acknowledges the whole window\n", seqnum);
+        new_ACKs++;
+        slidewindow(ackcount);
+        stoptimer(A);
+        return;
+    }
+    seqfirst = flow->buffer[flow->windowfirst].seqnum;
+    if (TRACE > 0) printf("----A: NAK %d is received, resend packet %d\n", seqnum, seqnum);
+    if (ackcount > 0) {
+        if (TRACE > 0)
+            printf("----A: NAK %d acknowledges packets %d to %d\n", seqnum, seqfirst,
+                   (seqnum + SEQSPACE - 1) % SEQSPACE);
+        new_ACKs++;
+        slidewindow(ackcount);
+    }
+    cwnd_nak(&flow->cc);
+
+    tolayer3(A, &flow->buffer[flow->windowfirst]);
+    packets_resent++;
+    nak_resends++;
+    if (flow->windowsent == 0) flow->windowsent = 1;
+    stoptimer(A);
+    starttimer(A, SENDRTT(RTT));
+    resendpending();
+}
+
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet) {
+static void A_input(const struct pkt *packet) {
     int ackcount = 0;
-    int i;
+
+    if (naks && packet->seqnum == NAK && !IsCorrupted(packet)) {
+        A_nak(packet->acknum);
+        return;
+    }
 
     /* if received ACK is not corrupted */
     if (!IsCorrupted(packet)) {
-        if (TRACE > 0) printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
+        if (TRACE > 0) printf("----A: uncorrupted ACK %d is received\n", packet->acknum);
         total_ACKs_received++;
 
         /* check if new ACK or duplicate */
-        if (windowcount != 0) {
-            int seqfirst = buffer[windowfirst].seqnum;
-            int seqlast = buffer[windowlast].seqnum;
+        if (flow->windowcount != 0) {
+            int seqfirst = flow->buffer[flow->windowfirst].seqnum;
+            int seqlast = flow->buffer[flow->windowlast].seqnum;
             /* check case when seqnum has and hasn't wrapped */
             if (((seqfirst <= seqlast) &&
-                 (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-                ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
+                 (packet->acknum >= seqfirst && packet->acknum <= seqlast)) ||
+                ((seqfirst > seqlast) && (packet->acknum >= seqfirst || packet->acknum <= seqlast))) {
 
                 /* packet is a new ACK */
-                if (TRACE > 0) printf("----A: ACK %d is not a duplicate\n", packet.acknum);
+                if (TRACE > 0) printf("----A: ACK %d is not a duplicate\n", packet->acknum);
                 new_ACKs++;
 
                 /* cumulative acknowledgement - determine how many packets are ACKed */
-                if (packet.acknum >= seqfirst) ackcount = packet.acknum + 1 - seqfirst;
+                if (packet->acknum >= seqfirst) ackcount = packet->acknum + 1 - seqfirst;
                 else
-                    ackcount = SEQSPACE - seqfirst + packet.acknum;
+                    ackcount = SEQSPACE - seqfirst + packet->acknum;
 
                 /* slide window by the number of packets ACKed */
-                windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
-
-                /* delete the acked packets from window buffer */
-                for (i = 0; i < ackcount; i++) windowcount--;
+                slidewindow(ackcount);
 
                 /* start timer again if there are still more unacked packets in window */
                 stoptimer(A);
-                if (windowcount > 0) starttimer(A, RTT);
-            }
+                if (flow->windowcount > 0) starttimer(A, SENDRTT(RTT));
+                resendpending(); /* the congestion window may have opened */
+            } else
+                cwnd_dupack(&flow->cc); /* B is still ACKing a packet before the window */
         } else if (TRACE > 0)
             printf("----A: duplicate ACK received, do nothing!\n");
     } else if (TRACE > 0)
@@ -145,94 +209,119 @@ void A_input(struct pkt packet) {
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void) {
-    int i;
+static void A_timerinterrupt(void) {
+    int i, n;
 
     if (TRACE > 0) printf("----A: time out,resend packets!\n");
+    cwnd_timeout(&flow->cc);
 
-    for (i = 0; i < windowcount; i++) {
+    /* as many as the congestion window allows, resendpending() sends the
+       rest as ACKs open it */
+    n = flow->windowcount < cwnd_window(&flow->cc) ? flow->windowcount : cwnd_window(&flow->cc);
+    flow->windowsent = n;
+    for (i = 0; i < n; i++) {
 
         if (TRACE > 0)
-            printf("---A: resending packet %d\n", (buffer[(windowfirst + i) % WINDOWSIZE]).seqnum);
+            printf("---A: resending packet %d\n", (flow->buffer[(flow->windowfirst + i) % WINDOWSIZE]).seqnum);
 
-        tolayer3(A, buffer[(windowfirst + i) % WINDOWSIZE]);
+        tolayer3(A, &flow->buffer[(flow->windowfirst + i) % WINDOWSIZE]);
         packets_resent++;
-        if (i == 0) starttimer(A, RTT);
+        if (i == 0) starttimer(A, SENDRTT(RTT));
     }
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void) {
+static void A_init(void) {
     /* initialise A's window, buffer and sequence number */
-    A_nextseqnum = 0; /* A starts with seq num 0, do not change this */
-    windowfirst = 0;
-    windowlast = -1; /* windowlast is where the last packet sent is stored.
+    flow->A_nextseqnum = 0; /* A starts with seq num 0, do not change this */
+    flow->windowfirst = 0;
+    flow->windowlast = -1; /* windowlast is where the last packet sent is stored.
              new packets are placed in winlast + 1
              so initially this is set to -1
            */
-    windowcount = 0;
+    flow->windowcount = 0;
+    flow->windowsent = 0;
+    cwnd_init(&flow->cc, SENDWINDOW(WINDOWSIZE));
 }
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
-
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet) {
+static void B_input(const struct pkt *packet) {
     struct pkt sendpkt;
+    bool nak = false;
     int i;
 
     /* if not corrupted and received packet is in order */
-    if ((!IsCorrupted(packet)) && (packet.seqnum == expectedseqnum)) {
-        if (TRACE > 0) printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
+    if ((!IsCorrupted(packet)) && (packet->seqnum == flow->expectedseqnum)) {
+        if (TRACE > 0) printf("----B: packet %d is correctly received, send ACK!\n", packet->seqnum);
         packets_received++;
 
         /* deliver to receiving application */
-        tolayer5(B, packet.payload);
+        tolayer5(B, packet->payload);
 
         /* send an ACK for the received packet */
-        sendpkt.acknum = expectedseqnum;
+        sendpkt.acknum = flow->expectedseqnum;
 
         /* update state variables */
-        expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+        flow->expectedseqnum = (flow->expectedseqnum + 1) % SEQSPACE;
+        flow->naked = false;
+    } else if (naks && !flow->naked) {
+        /* the first packet since the last delivered that is not the one
+           expected: ask for that one, once */
+        if (TRACE > 0)
+            printf("----B: packet corrupted or not expected sequence number, send NAK %d!\n", flow->expectedseqnum);
+        sendpkt.acknum = flow->expectedseqnum;
+        flow->naked = true;
+        nak = true;
     } else {
         /* packet is corrupted or out of order resend last ACK */
         if (TRACE > 0)
             printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-        if (expectedseqnum == 0) sendpkt.acknum = SEQSPACE - 1;
+        if (flow->expectedseqnum == 0) sendpkt.acknum = SEQSPACE - 1;
         else
-            sendpkt.acknum = expectedseqnum - 1;
+            sendpkt.acknum = flow->expectedseqnum - 1;
     }
 
     /* create packet */
-    sendpkt.seqnum = B_nextseqnum;
-    B_nextseqnum = (B_nextseqnum + 1) % 2;
+    if (nak) sendpkt.seqnum = NAK;
+    else {
+        sendpkt.seqnum = flow->B_nextseqnum;
+        flow->B_nextseqnum = (flow->B_nextseqnum + 1) % 2;
+    }
 
     /* we don't have any data to send.  fill payload with 0's */
     for (i = 0; i < 20; i++) sendpkt.payload[i] = '0';
 
     /* computer checksum */
-    sendpkt.checksum = ComputeChecksum(sendpkt);
+    sendpkt.checksum = ComputeChecksum(&sendpkt);
 
     /* send out packet */
-    tolayer3(B, sendpkt);
+    tolayer3(B, &sendpkt);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void) {
-    expectedseqnum = 0;
-    B_nextseqnum = 1;
+static void B_init(void) {
+    flow->expectedseqnum = 0;
+    flow->B_nextseqnum = 1;
+    flow->naked = false;
 }
 
+/* packets A has sent and not yet seen acknowledged */
+static int unacked(void) { return (flow->windowcount); }
+
 /******************************************************************************
  * The following functions need be completed only for bi-directional messages *
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message) {}
+static void B_output(struct msg message) {}
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void) {}
+static void B_timerinterrupt(void) {}
+
+const struct protocol gbn_protocol = {
+    "gbn", A_init, A_output, A_input, A_timerinterrupt, B_init, B_output, B_input, B_timerinterrupt,
+    sizeof(struct flowstate), setflow, unacked, WINDOWSIZE, OPT_AIMD | OPT_NAK};
@@ -0,0 +1,85 @@
+/* A protocol engine: the layer 4 entry points the emulator calls.
+   gbn.c, sr.c and sw.c each export one, and protocols.c keeps the registry
+   the emulator selects them from, so a single binary can run any of them. */
+struct protocol {
+    const char *name;
+    void (*A_init)(void);
+    void (*A_output)(struct msg);
+    void (*A_input)(const struct pkt *);
+    void (*A_timerinterrupt)(void);
+    void (*B_init)(void);
+    void (*B_output)(struct msg);
+    void (*B_input)(const struct pkt *);
+    void (*B_timerinterrupt)(void);
+
+    /* per-flow state: the emulator allocates flowsize bytes for every flow
+       and passes the block of the flow being served to setflow() before
+       calling any entry point.  The block holds no pointers, so checkpoints
+       save it as it is. */
+    size_t flowsize;
+    void (*setflow)(void *);
+
+    /* packets A has sent and not yet seen acknowledged, for the sampler */
+    int (*unacked)(void);
+
+    /* the largest window A can have, the engine's WINDOWSIZE */
+    int maxwindow;
+
+    /* the OPT_ bits (below) the engine implements */
+    int options;
+};
+
+/* all engines, NULL terminated */
+extern const struct protocol *const protocols[];
+
+/* the engine called name, or NULL */
+extern const struct protocol *findprotocol(const char *name);
+
+/* the engine a -p argument names, "engine[:option]...", or NULL if the
+   engine or an option is unknown or not implemented by the engine;
+   *options gets the options' OPT_ bits */
+#define OPT_AIMD 1 /* congestion window, see below */
+#define OPT_NAK 2  /* negative acknowledgements, see below */
+extern const struct protocol *selectprotocol(const char *spec, int *options);
+
+/* checksum routines shared by the engines */
+extern int ComputeChecksum(const struct pkt *);
+extern int IsCorrupted(const struct pkt *);
+
+/* AIMD congestion window for the window protocol senders (protocols.c).
+   When congestion is 0 (the default) the window is the fixed flow control
+   window and the cwnd_ routines do nothing. */
+extern int congestion;
+
+struct cwnd {
+    double cwnd;     /* congestion window, packets */
+    double ssthresh; /* slow start threshold, packets */
+    int maxwindow;   /* flow control window, cwnd never exceeds it */
+    int dupacks;     /* duplicate ACKs since the window base last moved */
+};
+
+extern void cwnd_init(struct cwnd *, int maxwindow);
+extern int cwnd_window(const struct cwnd *);    /* packets the sender may have unacknowledged */
+extern void cwnd_ack(struct cwnd *, int acked); /* the window base moved over acked packets */
+extern void cwnd_dupack(struct cwnd *);         /* an ACK that did not move the window base */
+extern void cwnd_timeout(struct cwnd *);
+extern void cwnd_nak(struct cwnd *); /* B reported a packet missing */
+
+/* Negative acknowledgements (gbn and sr).  When naks is set, B answers a
+   gap in the sequence numbers, or a corrupted packet, with a NAK, a packet
+   whose seqnum is NAK and whose acknum is the packet B is missing, once per
+   missing packet, and A resends that packet at once instead of waiting for
+   its timer. */
+#define NAK (-2)
+extern int naks;
+
+/* A's window and timeout, when set (rdt -W and -t, and the tuner) instead
+   of the engine's WINDOWSIZE and RTT.  The window can only be made smaller
+   than WINDOWSIZE, which the engine's buffers are sized by. */
+extern int sendwindow;  /* packets, 0: WINDOWSIZE */
+extern double sendrtt;  /* time units, 0: RTT */
+#define SENDWINDOW(windowsize) (sendwindow > 0 && sendwindow < (windowsize) ? sendwindow : (windowsize))
+#define SENDRTT(rtt) (sendrtt > 0 ? sendrtt : (rtt))
+
+/* included for extension to bidirectional communication */
+#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
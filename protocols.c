@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "protocol.h"
+#include "gbn.h"
+#include "sr.h"
+#include "sw.h"
+
+/* ******************************************************************
+   Protocol registry and the routines shared by the protocol engines.
+**********************************************************************/
+
+const struct protocol *const protocols[] = {&gbn_protocol, &sr_protocol, &sw_protocol, NULL};
+
+const struct protocol *findprotocol(const char *name) {
+    int i;
+
+    for (i = 0; protocols[i] != NULL; i++)
+        if (strcmp(protocols[i]->name, name) == 0) return (protocols[i]);
+    return (NULL);
+}
+
+const struct protocol *selectprotocol(const char *spec, int *options) {
+    char name[32];
+    const struct protocol *proto;
+    const char *opt;
+    size_t n;
+
+    n = strcspn(spec, ":");
+    if (n >= sizeof(name)) return (NULL);
+    strncpy(name, spec, n);
+    name[n] = '\0';
+    *options = 0;
+    for (opt = spec + n; *opt == ':'; opt += n) {
+        opt++;
+        n = strcspn(opt, ":");
+        if (n == 4 && strncmp(opt, "aimd", 4) == 0) *options |= OPT_AIMD;
+        else if (n == 3 && strncmp(opt, "nak", 3) == 0)
+            *options |= OPT_NAK;
+        else
+            return (NULL);
+    }
+    proto = findprotocol(name);
+    return (proto != NULL && (*options & ~proto->options) == 0 ? proto : NULL);
+}
+
+int naks = 0;
+
+int sendwindow = 0;
+double sendrtt = 0.0;
+
+/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
+   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
+   original checksum.  This procedure must generate a different checksum to the original if
+   the packet is corrupted.
+*/
+int ComputeChecksum(const struct pkt *packet) {
+    int checksum = 0;
+    int i;
+
+    checksum = packet->seqnum;
+    checksum += packet->acknum;
+    for (i = 0; i < 20; i++) checksum += (int)(packet->payload[i]);
+
+    return checksum;
+}
+
+int IsCorrupted(const struct pkt *packet) {
+    if (packet->checksum == ComputeChecksum(packet)) return (0);
+    else
+        return (1);
+}
+
+/******************************************************************************
+ * AIMD congestion window: slow start up to ssthresh, then one packet per     *
+ * window of ACKs; halve on the third duplicate ACK, back to one on timeout  *
+ *****************************************************************************/
+
+int congestion = 0;
+
+void cwnd_init(struct cwnd *cc, int maxwindow) {
+    cc->cwnd = congestion ? 1.0 : maxwindow;
+    cc->ssthresh = maxwindow;
+    cc->maxwindow = maxwindow;
+    cc->dupacks = 0;
+    if (congestion) setcwnd(A, cc->cwnd);
+}
+
+int cwnd_window(const struct cwnd *cc) { return ((int)cc->cwnd); }
+
+void cwnd_ack(struct cwnd *cc, int acked) {
+    if (!congestion) return;
+    cc->dupacks = 0;
+    while (acked-- > 0) {
+        if (cc->cwnd < cc->ssthresh) cc->cwnd += 1.0; /* slow start */
+        else
+            cc->cwnd += 1.0 / cc->cwnd; /* additive increase */
+    }
+    if (cc->cwnd > cc->maxwindow) cc->cwnd = cc->maxwindow;
+    setcwnd(A, cc->cwnd);
+}
+
+static void cwnd_cut(struct cwnd *cc, double cwnd) {
+    cc->ssthresh = cc->cwnd / 2 < 1.0 ? 1.0 : cc->cwnd / 2;
+    cc->cwnd = cwnd < 1.0 ? 1.0 : cwnd;
+    cwnd_cuts++;
+    if (TRACE > 0) printf("----A: congestion window cut to %.2f, ssthresh %.2f\n", cc->cwnd, cc->ssthresh);
+    setcwnd(A, cc->cwnd);
+}
+
+void cwnd_dupack(struct cwnd *cc) {
+    if (!congestion) return;
+    /* one decrease per loss: the count only restarts when the base moves */
+    if (++cc->dupacks == 3) cwnd_cut(cc, cc->cwnd / 2);
+}
+
+/* a NAK reports the loss at once, so it counts as the third duplicate ACK */
+void cwnd_nak(struct cwnd *cc) {
+    if (!congestion || cc->dupacks >= 3) return;
+    cc->dupacks = 3;
+    cwnd_cut(cc, cc->cwnd / 2);
+}
+
+void cwnd_timeout(struct cwnd *cc) {
+    if (!congestion) return;
+    cc->dupacks = 0;
+    cwnd_cut(cc, 1.0);
+}
@@ -0,0 +1,67 @@
+/* The emulator as a library (make librdt.a): complete simulations run in
+   the calling process, one after the other, each starting from a clean
+   state, so a sweep or fuzz harness does not pay a process launch per run.
+
+       struct simconfig cfg;
+       struct simresults res;
+
+       simdefaults(&cfg);
+       cfg.protocol = "sr";
+       cfg.loss = 0.1;
+       if (run_simulation(&cfg, &res) == 0 && res.ok) ... res.goodput ...
+
+   Link with -lm.  A run draws the same random numbers as rdt given the
+   same answers and options, so its results match the command line tool's
+   report.  The library is not reentrant: the emulator keeps its state in
+   globals, so only one run may be in progress per process. */
+
+/* what rdt asks for on stdin, and its options */
+struct simconfig {
+    const char *protocol; /* engine[:aimd][:nak], as for -p */
+    int nmsgs;            /* messages to simulate */
+    float loss;           /* probability a packet is lost */
+    float corrupt;        /* probability a packet is corrupted */
+    int direction;        /* loss and corruption on 0 A->B, 1 A<-B, 2 both */
+    float lambda;         /* average time between messages from A's layer 5 */
+    int trace;            /* TRACE, output goes to stdout */
+    unsigned int seed;    /* of the random number generator */
+    int flows;            /* -f */
+    float bnrate;         /* -b, 0: no bottleneck */
+    int bnqueue;          /* -q */
+    float until;          /* stop the run at this time, 0: when no events are left */
+    int window;           /* -W, 0: the engine's WINDOWSIZE */
+    float rtt;            /* -t, 0: the engine's RTT */
+};
+
+/* the end of run statistics */
+struct simresults {
+    float time;         /* simulated time when the run ended */
+    long events;        /* events simulated */
+    int sent;           /* messages handed to A */
+    int window_full;    /* of which A dropped because its window was full */
+    int new_ACKs;       /* new ACKs received at A */
+    int resent;         /* packets resent by A */
+    int received;       /* correct packets received at B */
+    int delivered;      /* messages delivered to B's layer 5 */
+    double goodput;     /* delivered per time unit */
+    int lost;           /* packets lost by the channel */
+    int corrupted;      /* and corrupted */
+    int bndrops;        /* packets dropped at the bottleneck */
+    int cwnd_cuts;      /* congestion window decreases (:aimd) */
+    double cwnd;        /* A's time averaged congestion window (:aimd), else 0 */
+    int naks;           /* NAKs sent by B (:nak) */
+    int nak_resends;    /* packets resent by A on a NAK */
+    double recovery;    /* mean time from a NAK to its packet arriving at B */
+    double recoverymax; /* and the longest */
+    int finished;       /* the run ended because no events were left, not at until */
+    int ok;             /* every message delivered was intact and in order and, if
+                           finished, every message A accepted was delivered */
+};
+
+/* fill in rdt's defaults: gbn, 1000 messages, no loss or corruption, a
+   message every 10 time units, one flow */
+extern void simdefaults(struct simconfig *);
+
+/* run the simulation cfg describes; 0 with *results filled in, or -1 if
+   cfg is not valid (unknown protocol, probability outside [0,1], ...) */
+extern int run_simulation(const struct simconfig *cfg, struct simresults *results);
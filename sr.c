@@ -1,9 +1,9 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <stdbool.h>
 #include <float.h>
 #include "emulator.h"
-#include "gbn.h"
+#include "protocol.h"
+#include "sr.h"
 
 /* ******************************************************************
    Selective Repeat Protocol.  Adapted from J.F.Kurose
@@ -24,83 +24,110 @@
 **********************************************************************/
 
 #define RTT 16.0 /* round trip time. MUST BE SET TO 16.0 when submitting assignment */
+#ifdef SR_WINDOWSIZE /* the window benchmark (bench/srwindow.c) and the tuner build larger windows */
+#define WINDOWSIZE SR_WINDOWSIZE
+#else
 #define WINDOWSIZE                                                                                                     \
     6 /* the maximum number of buffered unacked packet                                                                 \
          MUST BE SET TO 6 when submitting assignment */
+#endif
 #define SEQSPACE                                                                                                       \
     (2 * WINDOWSIZE)  /* the min sequence space for SR must be at least 2 *                                            \
                          windowsize */
 #define NOTINUSE (-1) /* used to fill header fields that are not being used */
 
-/* Helper function to find minimum of two doubles */
-double min_double(double a, double b) { return (a < b) ? a : b; }
-
-/* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
-   the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
-   original checksum.  This procedure must generate a different checksum to the original if
-   the packet is corrupted.
-*/
-int ComputeChecksum(struct pkt packet) {
-    int checksum = 0;
-    int i;
-
-    checksum = packet.seqnum;
-    checksum += packet.acknum;
-    for (i = 0; i < 20; i++) checksum += (int)(packet.payload[i]);
-
-    return checksum;
-}
-
-bool IsCorrupted(struct pkt packet) {
-    if (packet.checksum == ComputeChecksum(packet)) return (false);
-    else
-        return (true);
+/* Sequence number s always lives in buffer slot s % WINDOWSIZE: both start
+   at 0 and advance together, and SEQSPACE is a multiple of WINDOWSIZE.  So
+   an ACK or packet is mapped to its slot directly, and the per slot state
+   is one bit in a bitset (bit i of the set is bit i % SETBITS of word
+   i / SETBITS). */
+#define SETBITS (8 * (int)sizeof(unsigned long))
+#define SETWORDS ((WINDOWSIZE + SETBITS - 1) / SETBITS)
+
+/* A and B state of one connection; flow points at the one being served */
+struct flowstate {
+    /* sender (A) */
+    struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
+    int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+    int windowcount;                /* the number of packets currently awaiting an ACK */
+    int A_nextseqnum;               /* the next sequence number to be used by the sender */
+    unsigned long acked[SETWORDS];  /* slots in the window whose packet has been ACKed */
+    int nacked;                     /* ACKed packets the window base has not passed yet */
+    struct cwnd cc;                 /* congestion window, when enabled */
+
+    /* receiver (B) */
+    int expectedseqnum;              /* SR: This is rcv_base, the start of the receive window */
+    int B_nextseqnum;                /* SR: Sequence number for ACK packets sent by B */
+    struct pkt B_buffer[WINDOWSIZE]; /* Buffer for out-of-order packets */
+    int B_windowfirst;               /* Index in B_buffer corresponding to expectedseqnum (rcv_base) */
+    unsigned long received[SETWORDS]; /* slots holding a packet not yet delivered */
+    int B_naked;                      /* slots from rcv_base on all received or NAKed */
+};
+
+static struct flowstate *flow;
+
+static void setflow(void *state) { flow = state; }
+
+static int testbit(const unsigned long *set, int i) { return ((set[i / SETBITS] >> (i % SETBITS)) & 1); }
+
+static void setbit(unsigned long *set, int i) { set[i / SETBITS] |= 1UL << (i % SETBITS); }
+
+static void clearbit(unsigned long *set, int i) { set[i / SETBITS] &= ~(1UL << (i % SETBITS)); }
+
+/* the number of set bits from slot i on, wrapping around the window, before
+   the first clear one (at most max): a word at a time, the first clear bit
+   found with count trailing zeros.  The bits past WINDOWSIZE in the last
+   word are never set, so a run stops there and goes on at slot 0. */
+static int onesfrom(const unsigned long *set, int i, int max) {
+    unsigned long w;
+    int n = 0, k, left;
+
+    while (n < max) {
+        left = SETBITS - i % SETBITS; /* bits of this word from i on */
+        w = ~set[i / SETBITS] >> (i % SETBITS);
+        k = w != 0 ? __builtin_ctzl(w) : left;
+        n += k;
+        i += k;
+        if (i == WINDOWSIZE) i = 0;
+        else if (k < left)
+            break;
+    }
+    return (n < max ? n : max);
 }
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE]; /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;   /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;               /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;              /* the next sequence number to be used by the sender */
-static int A_status[WINDOWSIZE];      /* Status of packets in the buffer */
-
-#define AS_NONE 0 /* Slot is empty */
-#define AS_SENT 1 /* Packet sent, timer running, waiting for ACK */
-#define AS_RCVD 2 /* ACK received, but packet potentially not slided past yet */
-
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message) {
+static void A_output(struct msg message) {
     struct pkt sendpkt;
     int i;
 
     /* if not blocked waiting on ACK */
-    if (windowcount < WINDOWSIZE) {
+    if (flow->windowcount < cwnd_window(&flow->cc)) {
         if (TRACE > 1)
             printf("----A: New message arrives, send window is not full, send new messge to "
                    "layer3!\n");
 
         /* create packet */
-        sendpkt.seqnum = A_nextseqnum;
+        sendpkt.seqnum = flow->A_nextseqnum;
         sendpkt.acknum = NOTINUSE;
         for (i = 0; i < 20; i++) sendpkt.payload[i] = message.data[i];
-        sendpkt.checksum = ComputeChecksum(sendpkt);
+        sendpkt.checksum = ComputeChecksum(&sendpkt);
 
         /* put packet in window buffer */
-        windowlast = (windowlast + 1) % WINDOWSIZE;
-        buffer[windowlast] = sendpkt;
-        A_status[windowlast] = AS_SENT;
-        windowcount++;
+        flow->windowlast = (flow->windowlast + 1) % WINDOWSIZE;
+        flow->buffer[flow->windowlast] = sendpkt;
+        flow->windowcount++;
 
         /* send out packet */
         if (TRACE > 0) printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-        tolayer3(A, sendpkt);
+        tolayer3(A, &sendpkt);
 
         /* Start timer only if it's the first packet in the window */
-        if (windowcount == 1) { starttimer(A, RTT); }
+        if (flow->windowcount == 1) { starttimer(A, SENDRTT(RTT)); }
 
         /* get next sequence number, wrap back to 0 */
-        A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+        flow->A_nextseqnum = (flow->A_nextseqnum + 1) % SEQSPACE;
     }
     /* if blocked,  window is full */
     else {
@@ -109,65 +136,85 @@ void A_output(struct msg message) {
     }
 }
 
+/* B is missing packet seqnum (see NAK in protocol.h): resend it alone */
+static void A_nak(int seqnum) {
+    int off;
+
+    total_ACKs_received++;
+    off = (seqnum - flow->buffer[flow->windowfirst].seqnum + SEQSPACE) % SEQSPACE;
+    if (seqnum < 0 || seqnum >= SEQSPACE || off >= flow->windowcount || testbit(flow->acked, seqnum % WINDOWSIZE)) {
+        if (TRACE > 0) printf("----A: NAK %d is not for a packet awaiting ACK, do nothing!\n", seqnum);
+        return;
+    }
+    if (TRACE > 0) printf("----A: NAK %d is received, resend packet %d\n", seqnum, seqnum);
+    cwnd_nak(&flow->cc);
+    tolayer3(A, &flow->buffer[seqnum % WINDOWSIZE]);
+    packets_resent++;
+    nak_resends++;
+
+    /* the timer runs for the window base */
+    if (off == 0) {
+        stoptimer(A);
+        starttimer(A, SENDRTT(RTT));
+    }
+}
+
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet) {
+static void A_input(const struct pkt *packet) {
+    int ackidx; /* Index in the buffer */
+    int off;    /* packets between the window base and the one ACKed */
+    int slid;   /* packets the window base moved over */
     int i;
-    int ackidx = -1; /* Index in the buffer */
-    int current_idx;
+
+    if (naks && packet->seqnum == NAK && !IsCorrupted(packet)) {
+        A_nak(packet->acknum);
+        return;
+    }
 
     /* if received ACK is not corrupted */
     if (!IsCorrupted(packet)) {
-        if (TRACE > 0) printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
+        if (TRACE > 0) printf("----A: uncorrupted ACK %d is received\n", packet->acknum);
         total_ACKs_received++;
 
-        /* check if ACK is for a packet currently in the sender's window */
-        if (windowcount > 0) {
-            /* Check if acknum corresponds to any packet seqnum within the current window count */
-            /* This check handles sequence number wrap-around implicitly by comparing with buffered */
-            /* sequence numbers. */
-            for (i = 0; i < windowcount; ++i) {
-                current_idx = (windowfirst + i) % WINDOWSIZE;
-                if (buffer[current_idx].seqnum == packet.acknum) {
-                    ackidx = current_idx; /* Found index */
-                    break;
-                }
-            }
-
-            /* Check if we haven't already processed an ACK for this packet */
-            if (A_status[ackidx] == AS_SENT) {
-
-                if (TRACE > 0) printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-                new_ACKs++;
-
-                /* Mark packet as received and stop its logical timer */
-                A_status[ackidx] = AS_RCVD;
-
-                /* Slide the window base (windowfirst) past all contiguously acknowledged */
-                /* packets */
-                bool timer_reset = false;
-                while (windowcount > 0 && A_status[windowfirst] == AS_RCVD) {
-                    A_status[windowfirst] = AS_NONE; /* Reset status for the buffer slot */
-                    windowfirst = (windowfirst + 1) % WINDOWSIZE;
-                    windowcount--;
-                    timer_reset = true;
-                }
-
-                /* Restart the single physical timer based on remaining packets */
-                if (timer_reset) {
-                    stoptimer(A);
-                    if (windowcount > 0) { starttimer(A, RTT); }
-                }
-
-            } else {
-                /* Received ACK for a packet already marked as RCVD (or somehow not SENT). */
-                /* This can happen if ACKs are duplicated by the network. */
-                if (TRACE > 0) printf("----A: duplicate ACK received, do nothing!\n");
-            }
-        } else {
+        /* an ACK outside the window (for a packet the window base has already
+           passed, or not sent yet) is ignored, as is a second ACK for a packet
+           in it; both happen when ACKs are duplicated or overtaken */
+        off = (packet->acknum - flow->buffer[flow->windowfirst].seqnum + SEQSPACE) % SEQSPACE;
+        if (packet->acknum < 0 || packet->acknum >= SEQSPACE || off >= flow->windowcount) {
             if (TRACE > 0) printf("----A: duplicate ACK received, do nothing!\n");
+            return;
         }
+        ackidx = packet->acknum % WINDOWSIZE;
+        if (testbit(flow->acked, ackidx)) {
+            if (TRACE > 0) printf("----A: duplicate ACK received, do nothing!\n");
+            return;
+        }
+
+        if (TRACE > 0) printf("----A: ACK %d is not a duplicate\n", packet->acknum);
+        new_ACKs++;
+
+        /* Mark packet as received and stop its logical timer */
+        setbit(flow->acked, ackidx);
+        flow->nacked++;
+
+        /* Slide the window base (windowfirst) past all contiguously acknowledged packets */
+        slid = onesfrom(flow->acked, flow->windowfirst, flow->windowcount);
+        for (i = 0; i < slid; i++) {
+            clearbit(flow->acked, flow->windowfirst);
+            flow->windowfirst = (flow->windowfirst + 1) % WINDOWSIZE;
+        }
+        flow->windowcount -= slid;
+        flow->nacked -= slid;
+
+        /* Restart the single physical timer based on remaining packets */
+        if (slid > 0) {
+            stoptimer(A);
+            if (flow->windowcount > 0) { starttimer(A, SENDRTT(RTT)); }
+            cwnd_ack(&flow->cc, slid);
+        } else
+            cwnd_dupack(&flow->cc); /* ACKed above a hole at the window base */
     } else {
         /* Corrupted ACK - Keep original print */
         if (TRACE > 0) printf("----A: corrupted ACK is received, do nothing!\n");
@@ -175,128 +222,147 @@ void A_input(struct pkt packet) {
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void) {
-    int k;
-    int idx;
-    bool resent_any = false;
-
-    /* Identify the first packet whose timers have effectively expired */
-    for (k = 0; k < windowcount; k++) {
-        idx = (windowfirst + k) % WINDOWSIZE;
-        if (k < windowcount && A_status[idx] == AS_SENT) {
-
-            /* Check if this packet's timer expired */
-            /* This packet timed out */
-            if (!resent_any) {
-                if (TRACE > 0) printf("----A: time out,resend packets!\n");
-                resent_any = true;
-            }
-            if (TRACE > 0) printf("---A: resending packet %d\n", (buffer[idx]).seqnum);
-
-            tolayer3(A, buffer[idx]);
-            packets_resent++;
-        }
-        if (k == 0) starttimer(A, RTT);
-        if (resent_any) break;
-    }
+static void A_timerinterrupt(void) {
+    cwnd_timeout(&flow->cc);
+    if (flow->windowcount == 0) return;
+
+    /* resend the packet at the window base: it timed out first, and it is
+       never ACKed as A_input() slides past ACKed packets at once */
+    if (TRACE > 0) printf("----A: time out,resend packets!\n");
+    if (TRACE > 0) printf("---A: resending packet %d\n", (flow->buffer[flow->windowfirst]).seqnum);
+    tolayer3(A, &flow->buffer[flow->windowfirst]);
+    packets_resent++;
+    starttimer(A, SENDRTT(RTT));
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void) {
+static void A_init(void) {
     int i;
+
     /* initialise A's window, buffer and sequence number */
-    A_nextseqnum = 0; /* A starts with seq num 0, do not change this */
-    windowfirst = 0;
-    windowlast = -1; /* windowlast is where the last packet sent is stored.
-                        new packets are placed in winlast + 1
-                        so initially this is set to -1
-                     */
-    windowcount = 0;
-
-    /* Initialize packet status and timers */
-    for (i = 0; i < WINDOWSIZE; i++) { A_status[i] = AS_NONE; }
+    flow->A_nextseqnum = 0; /* A starts with seq num 0, do not change this */
+    flow->windowfirst = 0;
+    flow->windowlast = -1; /* windowlast is where the last packet sent is stored.
+                              new packets are placed in winlast + 1
+                              so initially this is set to -1
+                           */
+    flow->windowcount = 0;
+    cwnd_init(&flow->cc, SENDWINDOW(WINDOWSIZE));
+
+    /* no packet ACKed */
+    for (i = 0; i < SETWORDS; i++) flow->acked[i] = 0;
+    flow->nacked = 0;
 }
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* SR: This is rcv_base, the start of the receive window */
-static int B_nextseqnum;   /* SR: Sequence number for ACK packets sent by B (largely irrelevant in
-                              simplex) */
-
-static struct pkt B_buffer[WINDOWSIZE]; /* Buffer for out-of-order packets */
-static int B_windowfirst;               /* Index in B_buffer corresponding to expectedseqnum (rcv_base) */
-static int B_status[WINDOWSIZE];        /* Status of buffer slots */
+/* ask A for packet seqnum again */
+static void B_nak(int seqnum) {
+    struct pkt sendpkt;
+    int i;
 
-#define BS_NONE 0     /* Slot is empty / Expected but not received */
-#define BS_RECEIVED 1 /* Packet received and buffered, ACK sent */
+    if (TRACE > 0) printf("----B: packet %d is missing, send NAK!\n", seqnum);
+    sendpkt.seqnum = NAK;
+    sendpkt.acknum = seqnum;
+    for (i = 0; i < 20; i++) sendpkt.payload[i] = '0';
+    sendpkt.checksum = ComputeChecksum(&sendpkt);
+    tolayer3(B, &sendpkt);
+}
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet) {
+static void B_input(const struct pkt *packet) {
     struct pkt sendpkt;
     int i;
     int rcv_base;
     int off;
     int idx;
+    int n;
+    int naked, nakto; /* slots to NAK for this packet */
 
     /* Calculate window boundaries */
-    rcv_base = expectedseqnum;
+    rcv_base = flow->expectedseqnum;
 
     /* Process based on window check and corruption status */
     if (!IsCorrupted(packet)) {
         /* Packet is within the expected receive window [rcv_base, rcv_base+N-1] */
-        if (TRACE > 0) printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
+        if (TRACE > 0) printf("----B: packet %d is correctly received, send ACK!\n", packet->seqnum);
 
         /* --- Send ACK for the specific packet received --- */
         packets_received++;
-        sendpkt.acknum = packet.seqnum;
-
-        /* --- Buffer the packet if it hasn't been received before --- */
-        off = (packet.seqnum - rcv_base + SEQSPACE) % SEQSPACE;
-        idx = (B_windowfirst + off) % WINDOWSIZE;
-
-        if (B_status[idx] == BS_NONE) {
-            B_buffer[idx] = packet;
-            B_status[idx] = BS_RECEIVED; /* Mark as received */
+        sendpkt.acknum = packet->seqnum;
+
+        /* --- Buffer the packet if it is in the window and hasn't been received before --- */
+        /* packets from the previous window [rcv_base-N, rcv_base-1] are only re-ACKed */
+        off = (packet->seqnum - rcv_base + SEQSPACE) % SEQSPACE;
+        idx = (flow->B_windowfirst + off) % WINDOWSIZE;
+        naked = nakto = flow->B_naked;
+
+        if (off < WINDOWSIZE && !testbit(flow->received, idx)) {
+            if (off >= flow->B_naked) {
+                nakto = off;
+                flow->B_naked = off + 1;
+            }
+            flow->B_buffer[idx] = *packet;
+            setbit(flow->received, idx); /* Mark as received */
 
             /* --- Try to deliver contiguous packets starting from rcv_base --- */
-            while (B_status[B_windowfirst] == BS_RECEIVED) {
-                tolayer5(B, B_buffer[B_windowfirst].payload);
+            for (n = onesfrom(flow->received, flow->B_windowfirst, WINDOWSIZE); n > 0; n--) {
+                tolayer5(B, flow->B_buffer[flow->B_windowfirst].payload);
 
                 /* Advance window: clear buffer slot, move windowfirst index, increment expectedseqnum */
-                B_status[B_windowfirst] = BS_NONE;
-                B_windowfirst = (B_windowfirst + 1) % WINDOWSIZE;
-                expectedseqnum = (expectedseqnum + 1) % SEQSPACE; /* CRITICAL: Update expected base */
+                clearbit(flow->received, flow->B_windowfirst);
+                flow->B_windowfirst = (flow->B_windowfirst + 1) % WINDOWSIZE;
+                flow->expectedseqnum = (flow->expectedseqnum + 1) % SEQSPACE; /* CRITICAL: Update expected base */
+                flow->B_naked--;
             }
         }
+    } else if (naks && flow->B_naked == 0) {
+        /* Packet is corrupted: it may be the one at rcv_base, ask for that */
+        flow->B_naked = 1;
+        B_nak(rcv_base);
+        return;
     } else {
         /* Packet is corrupted. Discard silently. */
         return;
     }
 
     for (i = 0; i < 20; i++) sendpkt.payload[i] = '0'; /* No data payload in ACK */
-    sendpkt.seqnum = B_nextseqnum;
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-    B_nextseqnum = (B_nextseqnum + 1) % SEQSPACE;
-    tolayer3(B, sendpkt);
+    sendpkt.seqnum = flow->B_nextseqnum;
+    sendpkt.checksum = ComputeChecksum(&sendpkt);
+    flow->B_nextseqnum = (flow->B_nextseqnum + 1) % SEQSPACE;
+    tolayer3(B, &sendpkt);
+
+    /* a packet past slots neither received nor NAKed: the packets for
+       them were lost (the channel keeps the order), ask for each */
+    for (off = naked; naks && off < nakto; off++) B_nak((rcv_base + off) % SEQSPACE);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void) {
+static void B_init(void) {
     int i;
-    expectedseqnum = 0;
-    B_nextseqnum = 1;
-    B_windowfirst = 0;
-    for (i = 0; i < WINDOWSIZE; i++) { B_status[i] = BS_NONE; }
+    flow->expectedseqnum = 0;
+    flow->B_nextseqnum = 1;
+    flow->B_windowfirst = 0;
+    for (i = 0; i < SETWORDS; i++) flow->received[i] = 0;
+    flow->B_naked = 0;
 }
 
+/* packets A has sent and not yet seen acknowledged: the window slots still
+   waiting, not those ACKed out of order that the base has not passed yet */
+static int unacked(void) { return (flow->windowcount - flow->nacked); }
+
 /******************************************************************************
  * The following functions need be completed only for bi-directional messages *
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message) {}
+static void B_output(struct msg message) {}
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void) {}
\ No newline at end of file
+static void B_timerinterrupt(void) {}
+
+const struct protocol sr_protocol = {
+    "sr", A_init, A_output, A_input, A_timerinterrupt, B_init, B_output, B_input, B_timerinterrupt,
+    sizeof(struct flowstate), setflow, unacked, WINDOWSIZE, OPT_AIMD | OPT_NAK};
@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "emulator.h"
+#include "protocol.h"
+#include "sw.h"
+
+/* ******************************************************************
+   Stop and wait (alternating bit) protocol.  Adapted from J.F.Kurose
+   ALTERNATING BIT AND GO-BACK-N NETWORK EMULATOR: VERSION 1.2
+
+   A baseline for the window protocols: one packet outstanding at a time,
+   sequence numbers alternate between 0 and 1.  Messages that arrive while
+   a packet is waiting for its ACK are dropped (counted in window_full).
+**********************************************************************/
+
+#define RTT 16.0      /* round trip time */
+#define SEQSPACE 2    /* alternating bit */
+#define NOTINUSE (-1) /* used to fill header fields that are not being used */
+
+/* A and B state of one connection, one block per flow */
+struct flowstate {
+    /* sender (A) */
+    struct pkt lastpkt; /* the packet waiting for an ACK */
+    bool waiting;       /* true while lastpkt is unacknowledged */
+    int A_nextseqnum;   /* the next sequence number to be used by the sender */
+
+    /* receiver (B) */
+    int expectedseqnum; /* the sequence number expected next by the receiver */
+    int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+};
+
+static struct flowstate *flow;
+
+static void setflow(void *state) { flow = state; }
+
+/********* Sender (A) variables and functions ************/
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+static void A_output(struct msg message) {
+    int i;
+
+    /* if not blocked waiting on ACK */
+    if (!flow->waiting) {
+        if (TRACE > 1)
+            printf("----A: New message arrives, send window is not full, send new messge to "
+                   "layer3!\n");
+
+        /* create packet */
+        flow->lastpkt.seqnum = flow->A_nextseqnum;
+        flow->lastpkt.acknum = NOTINUSE;
+        for (i = 0; i < 20; i++) flow->lastpkt.payload[i] = message.data[i];
+        flow->lastpkt.checksum = ComputeChecksum(&flow->lastpkt);
+        flow->waiting = true;
+
+        /* send out packet */
+        if (TRACE > 0) printf("Sending packet %d to layer 3\n", flow->lastpkt.seqnum);
+        tolayer3(A, &flow->lastpkt);
+        starttimer(A, SENDRTT(RTT));
+
+        flow->A_nextseqnum = (flow->A_nextseqnum + 1) % SEQSPACE;
+    }
+    /* if blocked, window is full */
+    else {
+        if (TRACE > 0) printf("----A: New message arrives, send window is full\n");
+        window_full++;
+    }
+}
+
+/* called from layer 3, when a packet arrives for layer 4 */
+static void A_input(const struct pkt *packet) {
+    /* if received ACK is not corrupted */
+    if (!IsCorrupted(packet)) {
+        if (TRACE > 0) printf("----A: uncorrupted ACK %d is received\n", packet->acknum);
+        total_ACKs_received++;
+
+        /* the ACK for the outstanding packet ends the wait */
+        if (flow->waiting && packet->acknum == flow->lastpkt.seqnum) {
+            if (TRACE > 0) printf("----A: ACK %d is not a duplicate\n", packet->acknum);
+            new_ACKs++;
+            flow->waiting = false;
+            stoptimer(A);
+        } else if (TRACE > 0)
+            printf("----A: duplicate ACK received, do nothing!\n");
+    } else if (TRACE > 0)
+        printf("----A: corrupted ACK is received, do nothing!\n");
+}
+
+/* called when A's timer goes off */
+static void A_timerinterrupt(void) {
+    if (TRACE > 0) printf("----A: time out,resend packets!\n");
+    if (TRACE > 0) printf("---A: resending packet %d\n", flow->lastpkt.seqnum);
+
+    tolayer3(A, &flow->lastpkt);
+    packets_resent++;
+    starttimer(A, SENDRTT(RTT));
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity A routines are called. You can use it to do any initialization */
+static void A_init(void) {
+    flow->A_nextseqnum = 0; /* A starts with seq num 0, do not change this */
+    flow->waiting = false;
+}
+
+/********* Receiver (B)  variables and procedures ************/
+
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+static void B_input(const struct pkt *packet) {
+    struct pkt sendpkt;
+    int i;
+
+    /* if not corrupted and received packet is in order */
+    if ((!IsCorrupted(packet)) && (packet->seqnum == flow->expectedseqnum)) {
+        if (TRACE > 0) printf("----B: packet %d is correctly received, send ACK!\n", packet->seqnum);
+        packets_received++;
+
+        /* deliver to receiving application */
+        tolayer5(B, packet->payload);
+
+        /* send an ACK for the received packet */
+        sendpkt.acknum = flow->expectedseqnum;
+        flow->expectedseqnum = (flow->expectedseqnum + 1) % SEQSPACE;
+    } else {
+        /* packet is corrupted or a duplicate, ACK the last packet delivered */
+        if (TRACE > 0)
+            printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
+        sendpkt.acknum = (flow->expectedseqnum + 1) % SEQSPACE;
+    }
+
+    sendpkt.seqnum = flow->B_nextseqnum;
+    flow->B_nextseqnum = (flow->B_nextseqnum + 1) % 2;
+
+    /* we don't have any data to send.  fill payload with 0's */
+    for (i = 0; i < 20; i++) sendpkt.payload[i] = '0';
+    sendpkt.checksum = ComputeChecksum(&sendpkt);
+    tolayer3(B, &sendpkt);
+}
+
+/* the following routine will be called once (only) before any other */
+/* entity B routines are called. You can use it to do any initialization */
+static void B_init(void) {
+    flow->expectedseqnum = 0;
+    flow->B_nextseqnum = 1;
+}
+
+/* packets A has sent and not yet seen acknowledged */
+static int unacked(void) { return (flow->waiting ? 1 : 0); }
+
+/* Note that with simplex transfer from a-to-B, there is no B_output() */
+static void B_output(struct msg message) {}
+
+/* called when B's timer goes off */
+static void B_timerinterrupt(void) {}
+
+const struct protocol sw_protocol = {
+    "sw", A_init, A_output, A_input, A_timerinterrupt, B_init, B_output, B_input, B_timerinterrupt,
+    sizeof(struct flowstate), setflow, unacked, 1, 0};
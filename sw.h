@@ -0,0 +1,2 @@
+/* Stop and wait (alternating bit) engine, see protocol.h */
+extern const struct protocol sw_protocol;
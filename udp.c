@@ -0,0 +1,405 @@
+/* ******************************************************************
+   UDP loopback backend: runs a protocol engine unchanged over real UDP
+   sockets on 127.0.0.1 instead of the emulator, to measure the wall clock
+   throughput and latency of the same code on the kernel path.
+
+   A and B each own a socket, connected to each other.  tolayer3() queues
+   the packet on the sender's socket (after optionally losing or corrupting
+   it, as the emulator does) and the queues go out with sendmmsg() once the
+   event being handled is over.  One thread waits in epoll for either socket
+   or a timerfd set to the next deadline (a timer, or the next message from
+   layer 5 when pacing), reads what arrived with recvmmsg() and calls the
+   engine's entry points as the emulator would.  The engines count time in
+   the emulator's time units; here a time unit is -u microseconds of wall
+   clock time, so the RTT of 16 units and the -a message interval keep
+   their meaning and goodput per time unit compares with the emulator's.
+
+   Linux only (epoll, timerfd, sendmmsg/recvmmsg).
+**********************************************************************/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "emulator.h"
+#include "protocol.h"
+
+#ifndef DEFAULT_PROTOCOL
+#define DEFAULT_PROTOCOL "gbn"
+#endif
+#define BATCH 64 /* datagrams per sendmmsg()/recvmmsg() */
+#define TFD 2    /* epoll tag of the timerfd, the sockets are tagged A and B */
+
+int TRACE = 0;
+
+/* statistics updated by the engines */
+int window_full;
+int cwnd_cuts;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int nak_resends;
+int packets_received;
+
+static const struct protocol *proto;
+
+static int sock[2];          /* A's and B's socket, each connected to the other */
+static long unitns = 100000; /* nanoseconds per time unit */
+static long timer[2];        /* deadline of A's and B's timer, 0 if not running */
+static float lossprob;       /* probability that a packet is dropped */
+static float corruptprob;    /* probability that a packet is corrupted */
+
+/* packets tolayer3() queued on each entity's socket */
+static struct pkt outq[2][BATCH];
+static int noutq[2];
+
+static int nsim;            /* messages handed to A */
+static int nsimmax = 10000; /* messages to hand to A */
+static int delivered;       /* messages delivered to B's layer5 */
+static long datagrams;      /* UDP datagrams sent */
+static int nlost, ncorrupt; /* injected */
+static long *accepted;      /* when each accepted message went to A, by ordinal */
+static long *latency;       /* ns from A to B's layer5, in delivery order */
+static int nlatency;        /* latencies recorded */
+static int verifyfailed;
+
+static long now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000L + ts.tv_nsec);
+}
+
+static double uniform(void) { return (rand() / (RAND_MAX + 1.0)); }
+
+static void fail(const char *what) {
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+/* a non-blocking socket bound to 127.0.0.1, port chosen by the kernel */
+static int udpsocket(struct sockaddr_in *addr) {
+    socklen_t len = sizeof(*addr);
+    int fd, size = 1 << 20;
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0)) < 0) fail("socket");
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)addr, sizeof(*addr)) != 0 || getsockname(fd, (struct sockaddr *)addr, &len) != 0)
+        fail("bind");
+    return (fd);
+}
+
+/* send what tolayer3() queued; what a full socket buffer refuses is lost,
+   like a packet the channel loses */
+static void flush(void) {
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov[BATCH];
+    int e, i, n;
+
+    for (e = A; e <= B; e++) {
+        memset(msgs, 0, noutq[e] * sizeof(struct mmsghdr));
+        for (i = 0; i < noutq[e]; i++) {
+            iov[i].iov_base = &outq[e][i];
+            iov[i].iov_len = sizeof(struct pkt);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        for (i = 0; i < noutq[e]; i += n) {
+            if ((n = sendmmsg(sock[e], msgs + i, noutq[e] - i, 0)) <= 0) break;
+            datagrams += n;
+        }
+        noutq[e] = 0;
+    }
+}
+
+/* hand the packets waiting at entity e's socket to e */
+static void receive(int e) {
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov[BATCH];
+    struct pkt in[BATCH];
+    int i, n;
+
+    do {
+        memset(msgs, 0, sizeof(msgs));
+        for (i = 0; i < BATCH; i++) {
+            iov[i].iov_base = &in[i];
+            iov[i].iov_len = sizeof(struct pkt);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        n = recvmmsg(sock[e], msgs, BATCH, MSG_DONTWAIT, NULL);
+        for (i = 0; i < n; i++) {
+            if (msgs[i].msg_len != sizeof(struct pkt)) continue;
+            if (e == A) proto->A_input(&in[i]);
+            else
+                proto->B_input(&in[i]);
+        }
+        flush();
+    } while (n == BATCH);
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void tolayer3(int AorB, const struct pkt *packet) {
+    struct pkt *p;
+    double x;
+
+    if (uniform() < lossprob) {
+        nlost++;
+        if (TRACE > 0) printf("          TOLAYER3: packet being lost\n");
+        return;
+    }
+    if (noutq[AorB] == BATCH) flush();
+    p = &outq[AorB][noutq[AorB]++];
+    *p = *packet;
+    if (uniform() < corruptprob) {
+        ncorrupt++;
+        if ((x = uniform()) < .75) p->payload[0] = 'Z'; /* corrupt payload */
+        else if (x < .875)
+            p->seqnum = 999999;
+        else
+            p->acknum = 999999;
+        if (TRACE > 0) printf("          TOLAYER3: packet being corrupted\n");
+    }
+}
+
+/* a message carries its ordinal among the messages A accepted in its last
+   eight characters, so B's deliveries can be checked and timed; the rest
+   is a letter that follows the stamp, wrapping with it */
+#define ORDPOS 12
+#define ORDMOD 100000000L /* ordinals wrap at 10^(20 - ORDPOS) */
+
+static long ordinal(const char *data) {
+    long v = 0;
+    int i;
+
+    for (i = ORDPOS; i < 20; i++) {
+        if (data[i] < '0' || data[i] > '9') return (-1);
+        v = 10 * v + data[i] - '0';
+    }
+    return (v);
+}
+
+void tolayer5(int AorB, const char datasent[20]) {
+    long ord;
+
+    if (AorB != B) return;
+    ord = ordinal(datasent);
+    if (ord != delivered && !verifyfailed) {
+        printf("DELIVERY CHECK FAILED: delivered ordinal %ld, expected %d\n", ord, delivered);
+        verifyfailed = 1;
+    }
+    if (ord >= 0 && ord < nsimmax && nlatency < nsimmax) latency[nlatency++] = now() - accepted[ord];
+    delivered++;
+}
+
+void starttimer(int AorB, double increment) {
+    if (timer[AorB] != 0) {
+        printf("Warning: attempt to start a timer that is already started\n");
+        return;
+    }
+    timer[AorB] = now() + (long)(increment * unitns);
+}
+
+void stoptimer(int AorB) {
+    if (timer[AorB] == 0) {
+        printf("Warning: unable to cancel your timer. It wasn't running.\n");
+        return;
+    }
+    timer[AorB] = 0;
+}
+
+/* the congestion window is only reported by the emulator */
+void setcwnd(int AorB, double cwnd) {}
+
+/****************************************************************************/
+
+/* hand A the next message, 0 if A dropped it (window full).  A refused
+   probe is taken back: the message was not sent and is offered again. */
+static int offer(int probe) {
+    struct msg m;
+    long v;
+    int i, wasfull = window_full;
+
+    for (i = 0; i < ORDPOS; i++) m.data[i] = 97 + (nsim - window_full) % ORDMOD % 26;
+    for (v = nsim - window_full, i = 19; i >= ORDPOS; i--, v /= 10) m.data[i] = '0' + v % 10;
+    accepted[nsim - window_full] = now();
+    nsim++;
+    proto->A_output(m);
+    if (window_full == wasfull) return (1);
+    if (probe) {
+        nsim--;
+        window_full--;
+    }
+    return (0);
+}
+
+static int longorder(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return (x < y ? -1 : x > y);
+}
+
+static void usage(const char *prog) {
+    int i;
+
+    printf("usage: %s [-p protocol[:aimd][:nak]] [-n messages] [-l loss] [-c corruption] [-a interval]\n"
+           "       [-u usec] [-t trace] [-T seconds] [-S seed]\n",
+           prog);
+    printf("  -p name   protocol engine (default %s), name:aimd for the AIMD congestion window,\n", DEFAULT_PROTOCOL);
+    printf("            name:nak for NAKs from the receiver (both gbn, sr)\n");
+    printf("  -n n      messages to hand to A (default 10000)\n");
+    printf("  -l p      probability a packet is lost, -c that it is corrupted (default 0)\n");
+    printf("  -a t      average time units between messages, 0 (default): a new message as soon\n");
+    printf("            as A accepted the last one\n");
+    printf("  -u usec   wall clock microseconds per time unit (default 100)\n");
+    printf("  -T s      give up after s seconds (default 60)\n");
+    printf("protocols:");
+    for (i = 0; protocols[i] != NULL; i++) printf(" %s", protocols[i]->name);
+    printf("\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    struct sockaddr_in addr[2];
+    struct epoll_event ev, evs[3];
+    struct itimerspec its;
+    const char *protoname = DEFAULT_PROTOCOL;
+    double interval = 0.0; /* mean time units between messages, 0: saturate */
+    double seconds = 60.0;
+    unsigned int seed = 9999;
+    long start, end, deadline, next, t, sum;
+    unsigned long long expirations;
+    int ep, tfd, blocked, timedout, i, n, e;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) protoname = argv[++i];
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+            nsimmax = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+            lossprob = atof(argv[++i]);
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            corruptprob = atof(argv[++i]);
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            interval = atof(argv[++i]);
+        else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+            unitns = (long)(atof(argv[++i]) * 1000);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            TRACE = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc)
+            seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "-S") == 0 && i + 1 < argc)
+            seed = atoi(argv[++i]);
+        else
+            usage(argv[0]);
+    }
+    if (nsimmax < 1 || unitns < 1 || interval < 0 || seconds <= 0) usage(argv[0]);
+    if ((proto = selectprotocol(protoname, &n)) == NULL) {
+        printf("unknown protocol or option %s\n", protoname);
+        usage(argv[0]);
+    }
+    congestion = (n & OPT_AIMD) != 0;
+    naks = (n & OPT_NAK) != 0;
+
+    accepted = malloc(nsimmax * sizeof(long));
+    latency = malloc(nsimmax * sizeof(long));
+    proto->setflow(calloc(1, proto->flowsize));
+    if (accepted == 0 || latency == 0) {
+        printf("memory allocation for %d messages failed.", nsimmax);
+        exit(EXIT_FAILURE);
+    }
+    sock[A] = udpsocket(&addr[A]);
+    sock[B] = udpsocket(&addr[B]);
+    if (connect(sock[A], (struct sockaddr *)&addr[B], sizeof(addr[B])) != 0 ||
+        connect(sock[B], (struct sockaddr *)&addr[A], sizeof(addr[A])) != 0)
+        fail("connect");
+    if ((ep = epoll_create1(0)) < 0 || (tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) < 0) fail("epoll");
+    for (e = A; e <= TFD; e++) {
+        ev.events = EPOLLIN;
+        ev.data.u32 = e;
+        if (epoll_ctl(ep, EPOLL_CTL_ADD, e == TFD ? tfd : sock[e], &ev) != 0) fail("epoll_ctl");
+    }
+    memset(&its, 0, sizeof(its));
+    srand(seed);
+    proto->A_init();
+    proto->B_init();
+
+    start = next = now();
+    deadline = start + (long)(seconds * 1e9);
+    blocked = timedout = 0;
+    for (;;) {
+        t = now();
+        if (t >= deadline) {
+            timedout = 1;
+            break;
+        }
+        if (interval > 0) /* paced: the emulator's arrival process, in wall clock time */
+            while (nsim < nsimmax && next <= t) {
+                offer(0);
+                next += (long)(interval * 2 * uniform() * unitns);
+            }
+        else
+            while (nsim < nsimmax && !blocked) blocked = !offer(1);
+        for (e = A; e <= B; e++)
+            if (timer[e] != 0 && timer[e] <= t) {
+                timer[e] = 0;
+                if (e == A) proto->A_timerinterrupt();
+                else
+                    proto->B_timerinterrupt();
+                blocked = 0;
+            }
+        flush();
+        if (nsim == nsimmax && delivered == nsim - window_full && proto->unacked() == 0) break;
+
+        /* sleep until a packet arrives or the earliest deadline */
+        t = deadline;
+        for (e = A; e <= B; e++)
+            if (timer[e] != 0 && timer[e] < t) t = timer[e];
+        if (interval > 0 && nsim < nsimmax && next < t) t = next;
+        its.it_value.tv_sec = t / 1000000000L;
+        its.it_value.tv_nsec = t % 1000000000L;
+        if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) != 0) fail("timerfd_settime");
+        if ((n = epoll_wait(ep, evs, 3, -1)) < 0) fail("epoll_wait");
+        for (i = 0; i < n; i++) {
+            if (evs[i].data.u32 == TFD) {
+                if (read(tfd, &expirations, sizeof(expirations)) < 0) continue;
+            } else {
+                receive(evs[i].data.u32);
+                blocked = 0;
+            }
+        }
+    }
+    end = now();
+
+    printf("%s over UDP loopback, %g us per time unit\n", protoname, unitns / 1000.0);
+    printf("wall clock time:  %f s (%f time units)\n", (end - start) / 1e9, (double)(end - start) / unitns);
+    printf("number of messages handed to A:  %d \n", nsim);
+    printf("number of messages dropped due to full window:  %d \n", window_full);
+    printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+    printf("number of packet resends by A:  %d \n", packets_resent);
+    if (naks) printf("number of packet resends by A on a NAK:  %d \n", nak_resends);
+    printf("number of correct packets received at B:  %d \n", packets_received);
+    printf("number of messages delivered to application:  %d \n", delivered);
+    printf("datagrams sent:  %ld (lost %d, corrupted %d on purpose)\n", datagrams, nlost, ncorrupt);
+    printf("throughput:  %.0f messages/s, %.0f datagrams/s\n", delivered / ((end - start) / 1e9),
+           datagrams / ((end - start) / 1e9));
+    printf("goodput:  %f messages per time unit\n", delivered / ((double)(end - start) / unitns));
+    if (nlatency > 0) {
+        qsort(latency, nlatency, sizeof(long), longorder);
+        for (sum = 0, i = 0; i < nlatency; i++) sum += latency[i];
+        printf("latency A to B (us):  mean %.1f, median %.1f, 99%% %.1f, max %.1f\n", sum / 1e3 / nlatency,
+               latency[nlatency / 2] / 1e3, latency[(long)nlatency * 99 / 100] / 1e3, latency[nlatency - 1] / 1e3);
+    }
+    if (timedout) printf("gave up after %g s\n", seconds);
+    return (timedout || verifyfailed || delivered != nsim - window_full ? EXIT_FAILURE : EXIT_SUCCESS);
+}